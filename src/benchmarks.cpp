@@ -138,6 +138,96 @@ BENCHMARK(dynamic<logger_with_atomic>)->Threads(threads)->Iterations(count);
 BENCHMARK(dynamic<logger_with_tbb_allocator>)->Threads(threads)->Iterations(count);
 #endif
 
+#ifdef logger_with_overwriting_ring
+BENCHMARK(dynamic<logger_with_overwriting_ring>)->Threads(threads)->Iterations(count);
+#endif
+
+#ifdef logger_with_padded_slots
+BENCHMARK(dynamic<logger_with_padded_slots>)->Threads(threads)->Iterations(count);
+#endif
+
+#ifdef logger_with_split_slots
+BENCHMARK(dynamic<logger_with_split_slots>)->Threads(threads)->Iterations(count);
+#endif
+
+#ifdef logger_with_scrambled_slots
+BENCHMARK(dynamic<logger_with_scrambled_slots>)->Threads(threads)->Iterations(count);
+#endif
+
+#ifdef logger_with_scrambled_split_slots
+BENCHMARK(dynamic<logger_with_scrambled_split_slots>)->Threads(threads)->Iterations(count);
+#endif
+
+#ifdef logger_with_segmented_queue
+BENCHMARK(dynamic<logger_with_segmented_queue>)->Threads(threads)->Iterations(count);
+#endif
+
+#ifdef logger_with_unrolled_queue
+BENCHMARK(dynamic<logger_with_unrolled_queue>)->Threads(threads)->Iterations(count);
+#endif
+
+#ifdef logger_with_sharded_queue
+BENCHMARK(dynamic<logger_with_sharded_queue>)->Threads(threads)->Iterations(count);
+#endif
+
+#ifdef logger_with_per_cpu_queue
+BENCHMARK(dynamic<logger_with_per_cpu_queue>)->Threads(threads)->Iterations(count);
+#endif
+
+#ifdef logger_with_byte_ring
+BENCHMARK(dynamic<logger_with_byte_ring>)->Threads(threads)->Iterations(count);
+#endif
+
+#ifdef logger_with_inline_slots
+BENCHMARK(dynamic<logger_with_inline_slots>)->Threads(threads)->Iterations(count);
+#endif
+
+#ifdef logger_with_intrusive_queue
+BENCHMARK(dynamic<logger_with_intrusive_queue>)->Threads(threads)->Iterations(count);
+#endif
+
+#ifdef logger_with_prefetch
+BENCHMARK(dynamic<logger_with_prefetch>)->Threads(threads)->Iterations(count);
+#endif
+
+#ifdef logger_with_mpmc_ring
+BENCHMARK(dynamic<logger_with_mpmc_ring>)->Threads(threads)->Iterations(count);
+#endif
+
+#ifdef logger_with_mpmc_ring_2_consumers
+BENCHMARK(dynamic<logger_with_mpmc_ring_2_consumers>)->Threads(threads)->Iterations(count);
+#endif
+
+#ifdef logger_with_mpmc_ring_4_consumers
+BENCHMARK(dynamic<logger_with_mpmc_ring_4_consumers>)->Threads(threads)->Iterations(count);
+#endif
+
+// Drain rate of the consumer alone: a producer thread fills the ring, so the slots are cache
+// misses on lines modified by another core, then a single consume empties it.
+template <class Queue>
+static void drain(benchmark::State& state) {
+  const auto capacity = static_cast<size_t>(state.range(0));
+  Queue queue(capacity);
+  const std::string s{"12345678901234567890\n"};
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::jthread{[&] {
+      while (queue.push(s)) {}
+    }}.join();
+    state.ResumeTiming();
+    queue.consume([](std::string& elem) { benchmark::DoNotOptimize(elem.data()); });
+  }
+  state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(capacity));
+}
+
+BENCHMARK(drain<ngg::mpsc::ring<std::string>>)->RangeMultiplier(16)->Range(1 << 12, 1 << 20);
+BENCHMARK(drain<ngg::mpsc::ring<std::string, ngg::mpsc::ring_options{.prefetch = 4}>>)
+  ->RangeMultiplier(16)->Range(1 << 12, 1 << 20);
+BENCHMARK(drain<ngg::mpsc::ring<std::string, ngg::mpsc::ring_options{.prefetch = 8}>>)
+  ->RangeMultiplier(16)->Range(1 << 12, 1 << 20);
+BENCHMARK(drain<ngg::mpsc::ring<std::string, ngg::mpsc::ring_options{.prefetch = 16}>>)
+  ->RangeMultiplier(16)->Range(1 << 12, 1 << 20);
+
 template <class T>
 std::jthread create_logger() {
   std::binary_semaphore started{0};
@@ -227,6 +317,56 @@ int main(int argc, char** argv) {
 #ifdef logger_with_tbb_allocator
   logger_threads.emplace_back(create_logger<logger_with_tbb_allocator>());
 #endif
+#ifdef logger_with_overwriting_ring
+  logger_threads.emplace_back(create_logger<logger_with_overwriting_ring>());
+#endif
+#ifdef logger_with_padded_slots
+  logger_threads.emplace_back(create_logger<logger_with_padded_slots>());
+#endif
+#ifdef logger_with_split_slots
+  logger_threads.emplace_back(create_logger<logger_with_split_slots>());
+#endif
+#ifdef logger_with_scrambled_slots
+  logger_threads.emplace_back(create_logger<logger_with_scrambled_slots>());
+#endif
+#ifdef logger_with_scrambled_split_slots
+  logger_threads.emplace_back(create_logger<logger_with_scrambled_split_slots>());
+#endif
+#ifdef logger_with_segmented_queue
+  logger_threads.emplace_back(create_logger<logger_with_segmented_queue>());
+#endif
+#ifdef logger_with_unrolled_queue
+  logger_threads.emplace_back(create_logger<logger_with_unrolled_queue>());
+#endif
+#ifdef logger_with_sharded_queue
+  logger_threads.emplace_back(create_logger<logger_with_sharded_queue>());
+#endif
+#ifdef logger_with_per_cpu_queue
+  logger_threads.emplace_back(create_logger<logger_with_per_cpu_queue>());
+#endif
+#ifdef logger_with_byte_ring
+  logger_threads.emplace_back(create_logger<logger_with_byte_ring>());
+#endif
+#ifdef logger_with_inline_slots
+  logger_threads.emplace_back(create_logger<logger_with_inline_slots>());
+#endif
+#ifdef logger_with_intrusive_queue
+  logger_threads.emplace_back(create_logger<logger_with_intrusive_queue>());
+#endif
+#ifdef logger_with_prefetch
+  logger_threads.emplace_back(create_logger<logger_with_prefetch>());
+#endif
+#ifdef logger_with_mpmc_ring
+  logger_threads.emplace_back(create_logger<logger_with_mpmc_ring>());
+#endif
+#ifdef logger_with_mpmc_ring_2_consumers
+  for (size_t i = 0; i < logger_with_mpmc_ring_2_consumers::consumers; ++i)
+    logger_threads.emplace_back(create_logger<logger_with_mpmc_ring_2_consumers>());
+#endif
+#ifdef logger_with_mpmc_ring_4_consumers
+  for (size_t i = 0; i < logger_with_mpmc_ring_4_consumers::consumers; ++i)
+    logger_threads.emplace_back(create_logger<logger_with_mpmc_ring_4_consumers>());
+#endif
 
   reporter reporter;
   benchmark::RunSpecifiedBenchmarks(&reporter);
@@ -0,0 +1,93 @@
+// FROM: https://github.com/gubnik/mpsc-queue.git
+// COPYRIGHT: GNU GPL v3 or higher, Nikolay Gubankov (nikgub)
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <utility>
+
+namespace ngg::mpsc {
+
+/**
+ * @brief Immutable string that stores up to `N` bytes inline, longer ones on the heap
+ *
+ * Meant as a ring element: with `N` chosen above the typical message length
+ * nearly every element is built without touching the allocator, while the
+ * ring keeps a fixed stride of `N + 8` bytes. No terminating zero is kept.
+ *
+ * @tparam N inline capacity in bytes, e.g. 56 or 120 for one or two cache lines per element
+ */
+template <size_t N>
+class inline_string {
+  static_assert(N >= sizeof(char*), "inline capacity must at least hold the overflow pointer");
+
+public:
+  inline_string() noexcept : m_size(0) {}
+
+  explicit inline_string(std::string_view text) : m_size(text.size()) {
+    char* dest = m_inline;
+    if (!is_inline())
+      dest = m_heap = new char[m_size];
+    std::memcpy(dest, text.data(), m_size);
+  }
+
+  inline_string(const inline_string& other) : inline_string(other.view()) {}
+
+  inline_string(inline_string&& other) noexcept : m_size(other.m_size) {
+    if (is_inline())
+      std::memcpy(m_inline, other.m_inline, m_size);
+    else
+      m_heap = std::exchange(other.m_heap, nullptr);
+    other.m_size = 0;
+  }
+
+  inline_string& operator=(const inline_string& other) {
+    if (this != &other)
+      *this = inline_string(other);
+    return *this;
+  }
+
+  inline_string& operator=(inline_string&& other) noexcept {
+    if (this != &other) {
+      this->~inline_string();
+      new (this) inline_string(std::move(other));
+    }
+    return *this;
+  }
+
+  ~inline_string() {
+    if (!is_inline())
+      delete[] m_heap;
+  }
+
+  const char* data() const noexcept {
+    return is_inline() ? m_inline : m_heap;
+  }
+
+  size_t size() const noexcept {
+    return m_size;
+  }
+
+  std::string_view view() const noexcept {
+    return {data(), m_size};
+  }
+
+  /**
+   * @brief Whether the bytes live in the object itself
+   */
+  bool is_inline() const noexcept {
+    return m_size <= N;
+  }
+
+private:
+  size_t m_size;
+  union {
+    char m_inline[N];
+    char* m_heap;
+  };
+};
+
+}  // namespace ngg::mpsc
@@ -1,6 +1,15 @@
 // Prints the `text` to stdout, appends '\n' and flushes the stream in a thread-safe manner.
 // Should not be used by the final logger implementation. Useful for debugging.
+#include "inline_string.hpp"
+#include "mpmc_ring.hpp"
+#include "mpsc_byte_ring.hpp"
+#include "mpsc_intrusive_queue.hpp"
+#include "mpsc_overwriting_ring.hpp"
+#include "mpsc_per_cpu_queue.hpp"
+#include "mpsc_queue.hpp"
 #include "mpsc_ring.hpp"
+#include "mpsc_segmented_queue.hpp"
+#include "mpsc_sharded_queue.hpp"
 #include <cstdio>
 
 void print(std::string_view text);
@@ -26,29 +35,84 @@ constexpr T* reverse(T* head) noexcept {
 #if 1
 /**
  * @brief Logger implemented via a bounded MPSC queue
+ *
+ * @tparam Options ring layout, see @ref ngg::mpsc::ring_options
  */
-class logger {
+template <ngg::mpsc::ring_options Options = ngg::mpsc::ring_options{}>
+class ring_logger {
 public:
-  logger(size_t capacity_pow2 = static_cast<size_t>(16 * 1'024 * 1'024)) : queue_(capacity_pow2) {}
+  // Storage is faulted in lazily by default, so a large ring costs nothing until it fills up.
+  // Latency sensitive deployments can prefault and lock it instead, on huge pages.
+  ring_logger(size_t capacity_pow2 = static_cast<size_t>(16 * 1'024 * 1'024),
+    const ngg::mpsc::storage_options& storage = {.init = ngg::mpsc::storage_init::lazy}) :
+    queue_(capacity_pow2, storage) {}
 
   // Queues the message. Called from multiple threads.
   void post(std::string text) {
-    while (!queue_.emplace(std::move(text)))
-      ;
+    cross_node_posts_.sample(queue_.numa_node());
+    queue_.template emplace<ngg::mpsc::backpressure::block>(std::move(text));
   }
 
-  // Processes messages. Called from a single thread.
-  void run(std::stop_token stop) {
-    while (!stop.stop_requested()) {
-      std::string elem;
-      while (queue_.try_pull(elem))
-        std::fputs(elem.data(), stdout);
+  // Queues the message, sleeps up to `timeout` while the queue is full. Called from multiple
+  // threads. Returns false if the message was dropped on timeout or on a `stop` request.
+  bool post_for(std::string text, std::chrono::nanoseconds timeout, std::stop_token stop = {}) {
+    cross_node_posts_.sample(queue_.numa_node());
+    return queue_.emplace_for(stop, timeout, std::move(text));
+  }
+
+  // Queues a batch of messages with a single reservation per ring capacity. Called from multiple
+  // threads.
+  void post_bulk(std::span<std::string> texts) {
+    cross_node_posts_.sample(queue_.numa_node());
+    while (!texts.empty()) {
+      const auto count = std::min(texts.size(), queue_.capacity());
+      auto batch = queue_.template reserve<ngg::mpsc::backpressure::block>(count);
+      for (auto& text : texts.first(count))
+        batch.emplace(std::move(text));
+      batch.commit();
+      texts = texts.subspan(count);
     }
   }
 
+  // Processes messages, parks while the queue is empty. Called from a single thread, which is
+  // pinned to the ring's node when the ring was placed with `numa_policy::local`.
+  void run(std::stop_token stop) {
+    if (const int node = queue_.numa_node(); node >= 0)
+      ngg::mpsc::numa::pin_thread(node);
+    const auto print = [](std::string& elem) { std::fputs(elem.data(), stdout); };
+    while (!stop.stop_requested())
+      if (queue_.consume(print, consume_limit) == 0)
+        queue_.wait_for_data(stop);
+  }
+
+  // Sampled posts made from another NUMA node than the ring's, empty unless the ring is local.
+  const ngg::mpsc::numa::cross_node_counter& cross_node_posts() const {
+    return cross_node_posts_;
+  }
+
 private:
-  ngg::mpsc::ring<std::string> queue_;
+  // bounds a consume, so the stop token is checked while producers keep up
+  static constexpr size_t consume_limit = 1024;
+
+  ngg::mpsc::ring<std::string, Options> queue_;
+  ngg::mpsc::numa::cross_node_counter cross_node_posts_;
 };
+
+using logger = ring_logger<>;
+using logger_with_padded_slots =
+  ring_logger<ngg::mpsc::ring_options{.layout = ngg::mpsc::slot_layout::padded}>;
+using logger_with_split_slots =
+  ring_logger<ngg::mpsc::ring_options{.layout = ngg::mpsc::slot_layout::split}>;
+using logger_with_scrambled_slots = ring_logger<ngg::mpsc::ring_options{.scramble = true}>;
+using logger_with_scrambled_split_slots = ring_logger<
+  ngg::mpsc::ring_options{.layout = ngg::mpsc::slot_layout::split, .scramble = true}>;
+using logger_with_prefetch = ring_logger<ngg::mpsc::ring_options{.prefetch = 8}>;
+
+#define logger_with_padded_slots logger_with_padded_slots
+#define logger_with_split_slots logger_with_split_slots
+#define logger_with_scrambled_slots logger_with_scrambled_slots
+#define logger_with_scrambled_split_slots logger_with_scrambled_split_slots
+#define logger_with_prefetch logger_with_prefetch
 #else
 /**
  * @brief Logger implemented via an unbounded MPSC queue
@@ -62,16 +126,283 @@ public:
     queue_.push(std::move(text));
   }
 
-  // Processes messages. Called from a single thread.
+  // Queues a batch of messages with a single head exchange. Called from multiple threads.
+  void post_bulk(std::span<std::string> texts) {
+    queue_.push_bulk(texts);
+  }
+
+  // Processes messages, parks while the queue is empty. Called from a single thread.
   void run(std::stop_token stop) {
+    const auto print = [](std::string& elem) { std::fputs(elem.data(), stdout); };
     while (!stop.stop_requested())
-      while (auto v = queue_.pull())
-        std::fputs(v.value().data(), stdout);
+      if (queue_.drain(print, drain_limit) == 0)
+        queue_.wait_for_data(stop);
   }
 
 private:
+  // bounds a drain, so the stop token is checked while producers keep up
+  static constexpr size_t drain_limit = 1024;
+
   ngg::mpsc::stable_queue<std::string> queue_;
 };
 #endif
 
+/**
+ * @brief Logger implemented via a drop-oldest MPSC ring, the newest messages win
+ */
+class logger_with_overwriting_ring {
+public:
+  logger_with_overwriting_ring(size_t capacity_pow2 = static_cast<size_t>(1'024 * 1'024)) :
+    queue_(capacity_pow2) {}
+
+  // Queues the message, overwrites the oldest one if the ring is full. Called from multiple threads.
+  void post(std::string text) {
+    queue_.push(std::move(text));
+  }
+
+  // Processes messages, parks while the queue is empty. Called from a single thread.
+  void run(std::stop_token stop) {
+    while (!stop.stop_requested())
+      if (queue_.consume([](std::string& elem) { std::fputs(elem.data(), stdout); }) == 0)
+        queue_.wait_for_data(stop);
+  }
+
+  // Amount of messages lost to newer ones.
+  uint64_t overwritten() const {
+    return queue_.overwritten();
+  }
+
+private:
+  ngg::mpsc::overwriting_ring<std::string> queue_;
+};
+
+/**
+ * @brief Logger implemented via an unbounded MPSC queue of linked ring segments
+ *
+ * @tparam SegmentSize elements per segment, small ones make it a stable_queue with unrolled nodes
+ */
+template <size_t SegmentSize>
+class segmented_logger {
+public:
+  // Queues the message. Called from multiple threads.
+  void post(std::string text) {
+    queue_.push(std::move(text));
+  }
+
+  // Processes messages, parks while the queue is empty. Called from a single thread.
+  void run(std::stop_token stop) {
+    while (!stop.stop_requested())
+      if (queue_.consume([](std::string& elem) { std::fputs(elem.data(), stdout); }) == 0)
+        queue_.wait_for_data(stop);
+  }
+
+private:
+  ngg::mpsc::segmented_queue<std::string, SegmentSize> queue_;
+};
+
+using logger_with_segmented_queue = segmented_logger<1'024>;
+using logger_with_unrolled_queue = segmented_logger<32>;
+
+/**
+ * @brief Logger implemented via one SPSC ring per producer thread
+ */
+class logger_with_sharded_queue {
+public:
+  logger_with_sharded_queue(size_t shard_capacity_pow2 = static_cast<size_t>(64 * 1'024)) :
+    queue_(shard_capacity_pow2, {.init = ngg::mpsc::storage_init::lazy}) {}
+
+  // Queues the message into the calling thread's own ring. Called from multiple threads.
+  void post(std::string text) {
+    queue_.emplace<ngg::mpsc::backpressure::block>(std::move(text));
+  }
+
+  // Processes messages, parks while every ring is empty. Called from a single thread.
+  void run(std::stop_token stop) {
+    while (!stop.stop_requested())
+      if (queue_.consume([](std::string& elem) { std::fputs(elem.data(), stdout); }) == 0)
+        queue_.wait_for_data(stop);
+  }
+
+private:
+  ngg::mpsc::sharded_queue<std::string> queue_;
+};
+
+/**
+ * @brief Logger implemented via one MPSC ring per CPU
+ */
+class logger_with_per_cpu_queue {
+public:
+  logger_with_per_cpu_queue(size_t capacity_pow2 = static_cast<size_t>(256 * 1'024)) :
+    queue_(capacity_pow2, {.init = ngg::mpsc::storage_init::lazy}) {}
+
+  // Queues the message into the ring of the current CPU. Called from multiple threads.
+  void post(std::string text) {
+    queue_.emplace<ngg::mpsc::backpressure::block>(std::move(text));
+  }
+
+  // Processes messages, parks while every ring is empty. Called from a single thread.
+  void run(std::stop_token stop) {
+    while (!stop.stop_requested())
+      if (queue_.consume([](std::string& elem) { std::fputs(elem.data(), stdout); }) == 0)
+        queue_.wait_for_data(stop);
+  }
+
+private:
+  ngg::mpsc::per_cpu_queue<std::string> queue_;
+};
+
+/**
+ * @brief Logger implemented via a byte ring, message text is copied into the ring itself
+ */
+class logger_with_byte_ring {
+public:
+  logger_with_byte_ring(size_t capacity_pow2 = static_cast<size_t>(256 * 1'024 * 1'024)) :
+    queue_(capacity_pow2, {.init = ngg::mpsc::storage_init::lazy}) {}
+
+  // Copies the message into the ring, truncated to the longest message that fits. Called from
+  // multiple threads.
+  void post(std::string_view text) {
+    queue_.push<ngg::mpsc::backpressure::block>(text.substr(0, queue_.max_message_size()));
+  }
+
+  // Processes messages in place, parks while the queue is empty. Called from a single thread.
+  void run(std::stop_token stop) {
+    while (!stop.stop_requested())
+      if (queue_.consume([](std::string_view elem) {
+            std::fwrite(elem.data(), 1, elem.size(), stdout);
+          }) == 0)
+        queue_.wait_for_data(stop);
+  }
+
+private:
+  ngg::mpsc::byte_queue queue_;
+};
+
+/**
+ * @brief Logger implemented via a bounded MPSC queue of inline strings, only messages longer
+ * than 120 bytes are allocated
+ */
+class logger_with_inline_slots {
+public:
+  using message = ngg::mpsc::inline_string<120>;
+
+  logger_with_inline_slots(size_t capacity_pow2 = static_cast<size_t>(4 * 1'024 * 1'024)) :
+    queue_(capacity_pow2, {.init = ngg::mpsc::storage_init::lazy}) {}
+
+  // Queues the message. Called from multiple threads.
+  void post(std::string_view text) {
+    queue_.emplace<ngg::mpsc::backpressure::block>(text);
+  }
+
+  // Processes messages, parks while the queue is empty. Called from a single thread.
+  void run(std::stop_token stop) {
+    while (!stop.stop_requested())
+      if (queue_.consume([](message& elem) {
+            std::fwrite(elem.data(), 1, elem.size(), stdout);
+          }) == 0)
+        queue_.wait_for_data(stop);
+  }
+
+private:
+  // tokens apart from the 128 byte elements, so every element spans exactly two cache lines
+  ngg::mpsc::ring<message, ngg::mpsc::ring_options{.layout = ngg::mpsc::slot_layout::split}>
+    queue_;
+};
+
+/**
+ * @brief Logger implemented via an intrusive MPSC queue of pooled message objects
+ *
+ * Producers take a message from the pool, or allocate one while the pool is empty, the consumer
+ * hands it back after writing it, so a steady load allocates nothing.
+ */
+class logger_with_intrusive_queue {
+public:
+  logger_with_intrusive_queue(size_t pool_capacity_pow2 = static_cast<size_t>(64 * 1'024)) :
+    pool_(pool_capacity_pow2, {.init = ngg::mpsc::storage_init::lazy}) {}
+
+  ~logger_with_intrusive_queue() {
+    queue_.consume([](message& elem) { delete &elem; });
+    message* pooled = nullptr;
+    while (pool_.try_pull(pooled))
+      delete pooled;
+  }
+
+  // Queues the message. Called from multiple threads.
+  void post(std::string text) {
+    message* elem = nullptr;
+    if (!pool_.try_pull(elem))
+      elem = new message;
+    elem->text = std::move(text);
+    queue_.push(elem);
+  }
+
+  // Processes messages, parks while the queue is empty. Called from a single thread.
+  void run(std::stop_token stop) {
+    while (!stop.stop_requested())
+      if (queue_.consume([&](message& elem) {
+            std::fputs(elem.text.data(), stdout);
+            if (!pool_.push(&elem))
+              delete &elem;
+          }) == 0)
+        queue_.wait_for_data(stop);
+  }
+
+private:
+  struct message : ngg::mpsc::intrusive_hook {
+    std::string text;
+  };
+
+  ngg::mpsc::intrusive_queue<message> queue_;
+  ngg::mpsc::mpmc_queue<message*> pool_;  // producers take, the consumer returns
+};
+
+/**
+ * @brief Logger implemented via a bounded MPMC queue, drained by several sink threads
+ *
+ * @tparam Consumers amount of threads meant to call `run`, messages of a single producer may be
+ * written out of order once there is more than one
+ */
+template <size_t Consumers>
+class mpmc_ring_logger {
+public:
+  static constexpr size_t consumers = Consumers;
+
+  mpmc_ring_logger(size_t capacity_pow2 = static_cast<size_t>(16 * 1'024 * 1'024)) :
+    queue_(capacity_pow2, {.init = ngg::mpsc::storage_init::lazy}) {}
+
+  // Queues the message. Called from multiple threads.
+  void post(std::string text) {
+    queue_.emplace<ngg::mpsc::backpressure::block>(std::move(text));
+  }
+
+  // Processes messages, sleeps while the queue is empty. Called from `consumers` threads.
+  void run(std::stop_token stop) {
+    const auto print = [](std::string& elem) { std::fputs(elem.data(), stdout); };
+    while (!stop.stop_requested())
+      if (queue_.consume(print, consume_limit) == 0)
+        queue_.wait_for_data(stop);
+  }
+
+private:
+  // bounds a consume, so the stop token is checked while producers keep up
+  static constexpr size_t consume_limit = 1024;
+
+  ngg::mpsc::mpmc_queue<std::string> queue_;
+};
+
+using logger_with_mpmc_ring = mpmc_ring_logger<1>;
+using logger_with_mpmc_ring_2_consumers = mpmc_ring_logger<2>;
+using logger_with_mpmc_ring_4_consumers = mpmc_ring_logger<4>;
+
 #define logger logger
+#define logger_with_overwriting_ring logger_with_overwriting_ring
+#define logger_with_segmented_queue logger_with_segmented_queue
+#define logger_with_unrolled_queue logger_with_unrolled_queue
+#define logger_with_sharded_queue logger_with_sharded_queue
+#define logger_with_per_cpu_queue logger_with_per_cpu_queue
+#define logger_with_byte_ring logger_with_byte_ring
+#define logger_with_inline_slots logger_with_inline_slots
+#define logger_with_intrusive_queue logger_with_intrusive_queue
+#define logger_with_mpmc_ring logger_with_mpmc_ring
+#define logger_with_mpmc_ring_2_consumers logger_with_mpmc_ring_2_consumers
+#define logger_with_mpmc_ring_4_consumers logger_with_mpmc_ring_4_consumers
@@ -0,0 +1,299 @@
+// FROM: https://github.com/gubnik/mpsc-queue.git
+// COPYRIGHT: GNU GPL v3 or higher, Nikolay Gubankov (nikgub)
+
+#pragma once
+
+#include "storage.hpp"
+#include "types.hpp"
+#include "wait.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <stop_token>
+#include <type_traits>
+#include <utility>
+
+namespace ngg::mpsc {
+
+/**
+ * @brief Lossy MPMC lock-free queue based on a ring buffer for x86_64
+ *
+ * Uses the slot token protocol of @ref ngg::mpsc::lossy_queue, which is that of
+ * Vyukov's bounded MPMC queue, but claims the tail with a CAS as well, so any
+ * number of threads may consume. A consumer claims a run of published slots
+ * with a single CAS and visits them outside of it, hence elements of a single
+ * producer may be visited out of order by different consumers.
+ *
+ * Storage is a single zero-filled block, and a zeroed token marks its slot free
+ * for the first lap, as in @ref ngg::mpsc::lossy_queue
+ *
+ * @tparam T inner data type
+ */
+template <types::trasferable T>
+class mpmc_queue {
+public:
+  // zero bytes already are free slots, see ngg::mpsc::mpmc_queue::slot
+  explicit mpmc_queue(size_t capacity_pow2, const storage_options& storage_opts = {}) :
+    m_capacity(checked_capacity(capacity_pow2)), m_mask(m_capacity - 1),
+    m_storage(sizeof(slot) * m_capacity, std::max(size_t{64}, alignof(slot)), storage_opts),
+    m_slots(static_cast<slot*>(m_storage.data())) {}
+
+  ~mpmc_queue() {
+    uint64_t t = m_tail.load(std::memory_order_relaxed);
+    const uint64_t h = m_head.load(std::memory_order_relaxed);
+    for (; t != h; ++t)
+      element(t)->~T();
+  }
+
+  mpmc_queue(const mpmc_queue&) = delete;
+  mpmc_queue& operator=(const mpmc_queue&) = delete;
+  mpmc_queue(mpmc_queue&&) = delete;
+  mpmc_queue& operator=(mpmc_queue&&) = delete;
+
+public:
+  template <backpressure Policy = backpressure::fail>
+  bool push(const T& value) {
+    return emplace_impl<Policy>(value);
+  }
+
+  template <backpressure Policy = backpressure::fail>
+  bool push(T&& value) {
+    return emplace_impl<Policy>(std::move(value));
+  }
+
+  template <backpressure Policy = backpressure::fail, typename... Args>
+  bool emplace(Args&&... args) {
+    return emplace_impl<Policy>(std::forward<Args>(args)...);
+  }
+
+  bool try_pull(T& out) {
+    return consume([&](T& value) { out = std::move(value); }, 1) != 0;
+  }
+
+  /**
+   * @brief Visits up to `limit` ready elements in place. Called from any thread.
+   *
+   * Claims runs of at most `claim_batch` consecutive published slots with a
+   * CAS on the tail, so concurrent consumers split a backlog between them
+   * instead of one of them taking it all. Each element is passed to `visitor`
+   * as an lvalue and destroyed right after, its slot is handed back to
+   * producers immediately. Blocked producers are woken every quarter of the
+   * ring and at the end of the call.
+   *
+   * @param visitor callable with `void(T&)` signature, must not throw
+   * @param limit maximum amount of elements to visit
+   * @returns number of visited elements
+   */
+  template <typename F>
+  size_t consume(F&& visitor, size_t limit = std::numeric_limits<size_t>::max()) {
+    size_t count = 0;
+    size_t released = 0;
+    while (count < limit) {
+      uint64_t pos = 0;
+      const size_t claimed = try_claim_ready(pos, std::min(limit - count, claim_batch));
+      if (claimed == 0)
+        break;
+      for (uint64_t t = pos; t != pos + claimed; ++t) {
+        T* ptr = element(t);
+        visitor(*ptr);
+        ptr->~T();
+        store_token(t, t + m_capacity, std::memory_order_release);
+      }
+      count += claimed;
+      released += claimed;
+      if (released >= m_capacity / 4) {
+        m_space.notify_fenced();
+        released = 0;
+      }
+    }
+    if (released != 0)
+      m_space.notify_fenced();
+    return count;
+  }
+
+  /**
+   * @brief Blocks a consumer until a producer claimed a slot or `stop` is requested.
+   *
+   * Spins, yields, then sleeps with the other idle consumers, see
+   * @ref ngg::mpsc::waiters. A wakeup does not guarantee that the element is
+   * still there, another consumer may have taken it.
+   */
+  void wait_for_data(const std::stop_token& stop) {
+    const auto ready = [&] {
+      return m_head.load(std::memory_order_seq_cst) != m_tail.load(std::memory_order_relaxed);
+    };
+    backoff wait;
+    while (!wait.exhausted()) {
+      if (ready() || stop.stop_requested())
+        return;
+      wait.pause();
+    }
+    m_data.wait_until(ready, stop, waiters::clock::time_point::max());
+  }
+
+  /**
+   * @brief Checks for claimed slots, published or not. Approximate while consumers run.
+   */
+  bool empty() const {
+    return m_head.load(std::memory_order_seq_cst) == m_tail.load(std::memory_order_relaxed);
+  }
+
+  size_t capacity() const {
+    return m_capacity;
+  }
+
+  /**
+   * @brief NUMA node the slots are bound to, -1 if they are not bound to a single one
+   */
+  int numa_node() const {
+    return m_storage.numa_node();
+  }
+
+  /**
+   * @brief Amount of elements rejected under @ref ngg::mpsc::backpressure::drop
+   */
+  uint64_t dropped() const {
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  // largest run of slots a consumer claims with a single tail CAS
+  static constexpr size_t claim_batch = 64;
+
+  struct slot {
+    /**
+         * @brief token of the slot
+         *
+         * seq == idx       => producer can construct
+         * seq == idx + 1   => consumer can claim
+         * seq >= idx + cap => consumer claimed
+         *
+         * Stored minus the ticket's position in the ring, `idx & mask`, so the
+         * all-zero slot is free for lap 0.
+         */
+    std::atomic<uint64_t> token;
+    alignas(T) std::byte storage[sizeof(T)];
+  };
+
+  // slots are never constructed, zero-filled storage must already be valid tokens
+  static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+    std::is_trivially_destructible_v<std::atomic<uint64_t>>);
+
+  static size_t checked_capacity(size_t capacity) {
+    if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+      throw std::invalid_argument("Capacity must be power of two >= 2");
+    return capacity;
+  }
+
+  uint64_t load_token(uint64_t ticket, std::memory_order order) noexcept {
+    return m_slots[ticket & m_mask].token.load(order) + (ticket & m_mask);
+  }
+
+  void store_token(uint64_t ticket, uint64_t value, std::memory_order order) noexcept {
+    m_slots[ticket & m_mask].token.store(value - (ticket & m_mask), order);
+  }
+
+  T* element(uint64_t ticket) noexcept {
+    return reinterpret_cast<T*>(&m_slots[ticket & m_mask].storage);
+  }
+
+  /**
+   * @brief Claims a ticket if its slot is free. Nothing is claimed when the queue is full.
+   */
+  bool try_claim(uint64_t& head) {
+    head = m_head.load(std::memory_order_relaxed);
+    while (true) {
+      const auto diff = static_cast<int64_t>(load_token(head, std::memory_order_acquire) - head);
+      if (diff == 0) {
+        // seq_cst pairs with the sleeping consumers, see ngg::mpsc::waiters
+        if (m_head.compare_exchange_weak(head, head + 1, std::memory_order_seq_cst,
+              std::memory_order_relaxed))
+          return true;
+      }
+      else if (diff < 0)
+        return false;  // previous lap is still there, the queue is full
+      else
+        head = m_head.load(std::memory_order_relaxed);  // claimed by another producer
+    }
+  }
+
+  /**
+   * @brief Claims up to `limit` consecutive published tickets with a single tail CAS.
+   *
+   * A published token stays published until the consumer owning its ticket
+   * frees the slot, so a run seen ready at `tail` is still ready once the CAS
+   * proves that no other consumer claimed it meanwhile.
+   *
+   * @returns amount of claimed tickets starting at `tail`, 0 if none is ready
+   */
+  size_t try_claim_ready(uint64_t& tail, size_t limit) {
+    tail = m_tail.load(std::memory_order_relaxed);
+    while (true) {
+      size_t count = 0;
+      while (count < limit &&
+        load_token(tail + count, std::memory_order_acquire) == tail + count + 1)
+        ++count;
+      if (count == 0)
+        return 0;
+      if (m_tail.compare_exchange_weak(tail, tail + count, std::memory_order_relaxed,
+            std::memory_order_relaxed))
+        return count;
+    }
+  }
+
+  template <backpressure Policy>
+  bool claim(uint64_t& head) {
+    if constexpr (Policy == backpressure::block) {
+      if (try_claim(head)) [[likely]]
+        return true;
+      backoff wait;
+      while (!wait.exhausted()) {
+        wait.pause();
+        if (try_claim(head))
+          return true;
+      }
+      return m_space.wait_until([&] { return try_claim(head); }, {},
+        waiters::clock::time_point::max());
+    }
+    if (try_claim(head)) [[likely]]
+      return true;
+    if constexpr (Policy == backpressure::spin) {
+      backoff wait;
+      while (!wait.exhausted()) {
+        wait.pause();
+        if (try_claim(head))
+          return true;
+      }
+    }
+    if constexpr (Policy == backpressure::drop)
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  template <backpressure Policy, typename... Args>
+  bool emplace_impl(Args&&... args) {
+    uint64_t head = 0;
+    if (!claim<Policy>(head))
+      return false;
+    new (element(head)) T(std::forward<Args>(args)...);
+    store_token(head, head + 1, std::memory_order_release);
+    // no fence, the head CAS was seq_cst, see ngg::mpsc::waiters::notify
+    m_data.notify();
+    return true;
+  }
+
+  size_t m_capacity;
+  size_t m_mask;
+  storage m_storage;
+  slot* m_slots;
+  alignas(64) std::atomic<uint64_t> m_head = 0;
+  alignas(64) std::atomic<uint64_t> m_tail = 0;
+  alignas(64) std::atomic<uint64_t> m_dropped = 0;
+  waiters m_data;   // sleeping consumers, woken by producers
+  waiters m_space;  // sleeping producers, woken by consumers
+};
+
+}  // namespace ngg::mpsc
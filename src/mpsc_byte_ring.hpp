@@ -0,0 +1,217 @@
+// FROM: https://github.com/gubnik/mpsc-queue.git
+// COPYRIGHT: GNU GPL v3 or higher, Nikolay Gubankov (nikgub)
+
+#pragma once
+
+#include "storage.hpp"
+#include "wait.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <stop_token>
+#include <string_view>
+
+namespace ngg::mpsc {
+
+/**
+ * @brief Lock-free MPSC queue of variable-length byte messages for x86_64
+ *
+ * Producers reserve `header + length` bytes with a CAS on the byte head and
+ * copy the message straight into the ring, the consumer reads it in place.
+ * Nothing is allocated per message and nothing is freed across threads.
+ *
+ * Every record starts with an 8 byte header at an 8 byte aligned offset:
+ * zero while unpublished, `length << 1 | 1` for a message and `size << 1` for
+ * padding up to the end of the buffer, which keeps messages contiguous. The
+ * consumer zeroes every byte it consumed, so all bytes outside of the
+ * `[tail, head)` window are zero and a header is never read stale.
+ */
+class byte_queue {
+public:
+  explicit byte_queue(size_t capacity_pow2, const storage_options& storage_opts = {}) :
+    m_capacity(checked_capacity(capacity_pow2)), m_mask(m_capacity - 1),
+    m_storage(m_capacity, 64, storage_opts), m_data(static_cast<std::byte*>(m_storage.data())) {}
+
+  byte_queue(const byte_queue&) = delete;
+  byte_queue& operator=(const byte_queue&) = delete;
+  byte_queue(byte_queue&&) = delete;
+  byte_queue& operator=(byte_queue&&) = delete;
+
+public:
+  /**
+   * @brief Copies `bytes` into the ring as a single message.
+   *
+   * @tparam Policy behaviour when the ring has no room, see @ref ngg::mpsc::backpressure
+   * @returns false if the message was not queued, always for messages longer
+   * than @ref ngg::mpsc::byte_queue::max_message_size
+   */
+  template <backpressure Policy = backpressure::fail>
+  bool push(std::string_view bytes) {
+    if (bytes.size() > max_message_size()) [[unlikely]]
+      return false;
+    uint64_t pos = 0;
+    size_t pad = 0;
+    if (!claim<Policy>(record_size(bytes.size()), pos, pad))
+      return false;
+    if (pad != 0)
+      header(pos).store(pad << 1, std::memory_order_release);
+    std::byte* at = m_data + ((pos + pad) & m_mask);
+    std::memcpy(at + header_size, bytes.data(), bytes.size());
+    header(pos + pad).store((uint64_t{bytes.size()} << 1) | 1, std::memory_order_release);
+    m_parker.notify();
+    return true;
+  }
+
+  /**
+   * @brief Visits up to `limit` ready messages in place.
+   *
+   * The view passed to `visitor` is only valid during the call. Consumed bytes
+   * are handed back to producers every quarter of the ring and at the end.
+   *
+   * @param visitor callable with `void(std::string_view)` signature, must not throw
+   * @param limit maximum amount of messages to visit
+   * @returns number of visited messages
+   */
+  template <typename F>
+  size_t consume(F&& visitor, size_t limit = std::numeric_limits<size_t>::max()) {
+    uint64_t published = m_tail.load(std::memory_order_relaxed);
+    uint64_t pos = published;
+    size_t count = 0;
+    while (count < limit) {
+      const uint64_t word = header(pos).load(std::memory_order_acquire);
+      if (word == 0)
+        break;
+      std::byte* at = m_data + (pos & m_mask);
+      size_t size = 0;
+      if ((word & 1) != 0) {
+        const auto length = static_cast<size_t>(word >> 1);
+        visitor(std::string_view(reinterpret_cast<const char*>(at + header_size), length));
+        // only the written bytes, the rest of the record is still zero
+        std::memset(at, 0, header_size + length);
+        size = record_size(length);
+        ++count;
+      }
+      else {
+        size = static_cast<size_t>(word >> 1);
+        std::memset(at, 0, header_size);
+      }
+      pos += size;
+      if (pos - published >= m_capacity / 4) {
+        release_space(pos);
+        published = pos;
+      }
+    }
+    if (pos != published)
+      release_space(pos);
+    return count;
+  }
+
+  /**
+   * @brief Blocks the consumer until a producer reserved bytes or `stop` is requested.
+   *
+   * Spins, yields, then parks, see @ref ngg::mpsc::parker
+   */
+  void wait_for_data(const std::stop_token& stop) {
+    const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    m_parker.wait([&] { return m_head.load(std::memory_order_seq_cst) != tail; }, stop);
+  }
+
+  size_t capacity() const {
+    return m_capacity;
+  }
+
+  /**
+   * @brief Longest message that fits, half of the ring minus the header
+   *
+   * A record never straddles the end of the buffer, so a message plus the
+   * padding in front of it must fit into an empty ring from any offset.
+   */
+  size_t max_message_size() const {
+    return m_capacity / 2 - header_size;
+  }
+
+  /**
+   * @brief Amount of messages rejected under @ref ngg::mpsc::backpressure::drop
+   */
+  uint64_t dropped() const {
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr size_t header_size = sizeof(uint64_t);
+
+  /**
+   * @brief Hands the bytes before `pos` back to producers and wakes the blocked ones.
+   */
+  void release_space(uint64_t pos) noexcept {
+    m_tail.store(pos, std::memory_order_release);
+    m_space.notify_fenced();
+  }
+
+  static size_t checked_capacity(size_t capacity) {
+    if (capacity < 64 || (capacity & (capacity - 1)) != 0)
+      throw std::invalid_argument("Capacity must be power of two >= 64");
+    return capacity;
+  }
+
+  static constexpr size_t record_size(size_t length) noexcept {
+    return header_size + (length + header_size - 1) / header_size * header_size;
+  }
+
+  std::atomic_ref<uint64_t> header(uint64_t pos) noexcept {
+    return std::atomic_ref<uint64_t>(*reinterpret_cast<uint64_t*>(m_data + (pos & m_mask)));
+  }
+
+  /**
+   * @brief Reserves `size` bytes, plus padding if they would straddle the end.
+   *
+   * Nothing is reserved when the ring has no room.
+   */
+  bool try_claim(size_t size, uint64_t& pos, size_t& pad) {
+    pos = m_head.load(std::memory_order_relaxed);
+    while (true) {
+      const size_t offset = pos & m_mask;
+      pad = offset + size > m_capacity ? m_capacity - offset : 0;
+      if (pos + pad + size - m_tail.load(std::memory_order_acquire) > m_capacity)
+        return false;
+      // seq_cst pairs with the parked consumer, see ngg::mpsc::parker
+      if (m_head.compare_exchange_weak(pos, pos + pad + size, std::memory_order_seq_cst,
+            std::memory_order_relaxed))
+        return true;
+    }
+  }
+
+  template <backpressure Policy>
+  bool claim(size_t size, uint64_t& pos, size_t& pad) {
+    if (try_claim(size, pos, pad)) [[likely]]
+      return true;
+    if constexpr (Policy == backpressure::drop)
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+    if constexpr (Policy == backpressure::spin || Policy == backpressure::block) {
+      backoff wait;
+      while (!wait.exhausted()) {
+        wait.pause();
+        if (try_claim(size, pos, pad))
+          return true;
+      }
+    }
+    if constexpr (Policy == backpressure::block)
+      return m_space.wait_until([&] { return try_claim(size, pos, pad); }, {},
+        waiters::clock::time_point::max());
+    return false;
+  }
+
+  size_t m_capacity;
+  size_t m_mask;
+  storage m_storage;
+  std::byte* m_data;
+  alignas(64) std::atomic<uint64_t> m_head = 0;
+  alignas(64) std::atomic<uint64_t> m_tail = 0;
+  alignas(64) std::atomic<uint64_t> m_dropped = 0;
+  parker m_parker;   // sleeping consumer, woken by producers
+  waiters m_space;  // sleeping producers, woken by the consumer
+};
+
+}  // namespace ngg::mpsc
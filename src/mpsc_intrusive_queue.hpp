@@ -0,0 +1,151 @@
+// FROM: https://github.com/gubnik/mpsc-queue.git
+// COPYRIGHT: GNU GPL v3 or higher, Nikolay Gubankov (nikgub)
+
+#pragma once
+
+#include "wait.hpp"
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <limits>
+#include <stop_token>
+
+namespace ngg::mpsc {
+
+/**
+ * @brief Link embedded into objects queued by @ref ngg::mpsc::intrusive_queue
+ *
+ * An object may be in one queue at a time, and must stay alive until the
+ * consumer took it out.
+ */
+struct intrusive_hook {
+  std::atomic<intrusive_hook*> next = nullptr;
+};
+
+/**
+ * @brief Intrusive unbounded MPSC queue for x86_64
+ *
+ * Implements Vyukov's intrusive MPSC queue: producers link objects they
+ * already own through their @ref ngg::mpsc::intrusive_hook base with one
+ * exchange, the queue itself never allocates, copies or destroys anything.
+ * An embedded stub node stands in for the dummy of
+ * @ref ngg::mpsc::stable_queue and is requeued whenever the consumer takes
+ * the last object out.
+ *
+ * Push is wait-free. Pop is lock-free only for the consumer: between a
+ * producer's exchange and its link store the objects behind it are not
+ * reachable yet, and pop reports the queue empty meanwhile.
+ *
+ * @tparam T object type, derived from @ref ngg::mpsc::intrusive_hook
+ */
+template <std::derived_from<intrusive_hook> T>
+class intrusive_queue {
+public:
+  intrusive_queue() : m_head(&m_stub), m_tail(&m_stub) {}
+
+  intrusive_queue(const intrusive_queue&) = delete;
+  intrusive_queue& operator=(const intrusive_queue&) = delete;
+  intrusive_queue(intrusive_queue&&) = delete;
+  intrusive_queue& operator=(intrusive_queue&&) = delete;
+
+public:
+  /**
+   * @brief Links `object` to the queue. Called from multiple threads.
+   *
+   * @param object object not in any queue, owned by the caller again once popped
+   */
+  void push(T* object) noexcept {
+    link(object);
+    m_parker.notify();
+  }
+
+  /**
+   * @brief Unlinks the oldest object. Called by the consumer only.
+   *
+   * @returns the object, or nullptr if the queue is empty or its next object
+   * is not linked yet
+   */
+  T* pop() noexcept {
+    intrusive_hook* tail = m_tail;
+    intrusive_hook* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &m_stub) {
+      if (next == nullptr)
+        return nullptr;
+      m_tail = tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next != nullptr) [[likely]] {
+      m_tail = next;
+      return static_cast<T*>(tail);
+    }
+    if (tail != m_head.load(std::memory_order_acquire))
+      return nullptr;  // a producer exchanged the head but has not linked yet
+    // the last object keeps its place until the stub is queued behind it
+    link(&m_stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr)
+      return nullptr;  // another producer got in between, its link follows
+    m_tail = next;
+    return static_cast<T*>(tail);
+  }
+
+  /**
+   * @brief Visits up to `limit` ready objects.
+   *
+   * Each object is unlinked before `visitor` sees it, so the visitor may
+   * recycle or delete it.
+   *
+   * @param visitor callable with `void(T&)` signature
+   * @param limit maximum amount of objects to visit
+   * @returns number of visited objects
+   */
+  template <typename F>
+  size_t consume(F&& visitor, size_t limit = std::numeric_limits<size_t>::max()) {
+    size_t count = 0;
+    while (count < limit) {
+      T* object = pop();
+      if (object == nullptr)
+        break;
+      visitor(*object);
+      ++count;
+    }
+    return count;
+  }
+
+  /**
+   * @brief Blocks the consumer until a producer linked an object or `stop` is requested.
+   *
+   * Spins, yields, then parks, see @ref ngg::mpsc::parker
+   */
+  void wait_for_data(const std::stop_token& stop) {
+    m_parker.wait(
+      [&] {
+        return m_head.load(std::memory_order_seq_cst) != m_tail ||
+          m_tail->next.load(std::memory_order_acquire) != nullptr;
+      },
+      stop);
+  }
+
+  /**
+   * @brief Checks for linked objects. Called by the consumer only.
+   */
+  bool empty() const {
+    return m_tail == &m_stub && m_stub.next.load(std::memory_order_acquire) == nullptr &&
+      m_head.load(std::memory_order_seq_cst) == &m_stub;
+  }
+
+private:
+  void link(intrusive_hook* hook) noexcept {
+    hook->next.store(nullptr, std::memory_order_relaxed);
+    // seq_cst pairs with the parked consumer, see ngg::mpsc::parker
+    intrusive_hook* prev = m_head.exchange(hook, std::memory_order_seq_cst);
+    prev->next.store(hook, std::memory_order_release);
+  }
+
+  alignas(64) std::atomic<intrusive_hook*> m_head;  // newest object
+  alignas(64) intrusive_hook* m_tail;               // oldest object, consumer only
+  intrusive_hook m_stub;
+  parker m_parker;  // sleeping consumer, woken by producers
+};
+
+}  // namespace ngg::mpsc
@@ -0,0 +1,238 @@
+// FROM: https://github.com/gubnik/mpsc-queue.git
+// COPYRIGHT: GNU GPL v3 or higher, Nikolay Gubankov (nikgub)
+
+#pragma once
+
+#include "types.hpp"
+#include "wait.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <stop_token>
+#include <utility>
+
+namespace ngg::mpsc {
+
+/**
+ * @brief Drop-oldest MPSC queue based on a ring buffer for x86_64
+ *
+ * Sibling of @ref ngg::mpsc::lossy_queue for flight-recorder style logging:
+ * when the consumer falls behind, the newest elements win. Producers take a
+ * ticket with a single fetch_add and never wait for the consumer to drain,
+ * a full slot is reclaimed in O(1) by overwriting the element of the previous
+ * lap.
+ *
+ * Producers are lock-free, not wait-free: a slot is busy while the consumer
+ * moves its element out or while a producer of the previous lap still
+ * constructs it, which may allocate. A producer landing on a busy slot backs
+ * off until it is released, and waits as long as a preempted owner is
+ * descheduled.
+ *
+ * Every element that never reaches the consumer is counted, see
+ * @ref ngg::mpsc::overwriting_queue::overwritten
+ *
+ * @tparam T inner data type
+ */
+template <types::trasferable T>
+class overwriting_queue {
+public:
+  explicit overwriting_queue(size_t capacity_pow2) {
+    size_t cap = capacity_pow2;
+    if (cap < 2 || (cap & (cap - 1)) != 0)
+      throw std::invalid_argument("Capacity must be power of two >= 2");
+    m_capacity = cap;
+    m_mask = m_capacity - 1;
+    m_slots = static_cast<slot*>(::operator new[](sizeof(slot) * m_capacity));
+    for (size_t i = 0; i < m_capacity; ++i) {
+      new (&m_slots[i]) slot();
+      m_slots[i].token.store(make_token(i, state::empty), std::memory_order_relaxed);
+    }
+    m_head.store(0, std::memory_order_relaxed);
+    m_tail.store(0, std::memory_order_relaxed);
+    m_overwritten.store(0, std::memory_order_relaxed);
+  }
+
+  ~overwriting_queue() {
+    for (size_t i = 0; i < m_capacity; ++i) {
+      slot& s = m_slots[i];
+      if (state_of(s.token.load(std::memory_order_relaxed)) == state::full)
+        reinterpret_cast<T*>(&s.storage)->~T();
+      s.~slot();
+    }
+    ::operator delete[](m_slots);
+  }
+
+  overwriting_queue(const overwriting_queue&) = delete;
+  overwriting_queue& operator=(const overwriting_queue&) = delete;
+  overwriting_queue(overwriting_queue&&) = delete;
+  overwriting_queue& operator=(overwriting_queue&&) = delete;
+
+public:
+  /**
+   * @returns false if the element itself was overwritten before it got stored
+   */
+  bool push(const T& value) {
+    return emplace_impl(value);
+  }
+
+  bool push(T&& value) {
+    return emplace_impl(std::move(value));
+  }
+
+  template <typename... Args>
+  bool emplace(Args&&... args) {
+    return emplace_impl(std::forward<Args>(args)...);
+  }
+
+  bool try_pull(T& out) {
+    return consume([&](T& value) { out = std::move(value); }, 1) != 0;
+  }
+
+  /**
+   * @brief Visits up to `limit` ready elements.
+   *
+   * Tickets whose element was overwritten are skipped, so the visited elements
+   * are always in ticket order but not necessarily consecutive. Each element is
+   * moved out and its slot released before `visitor` sees it, so a lapping
+   * producer waits for a move, never for the visitor.
+   *
+   * @param visitor callable with `void(T&)` signature, must not throw
+   * @param limit maximum amount of elements to visit
+   * @returns number of visited elements
+   */
+  template <typename F>
+  size_t consume(F&& visitor, size_t limit = std::numeric_limits<size_t>::max()) {
+    uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    size_t count = 0;
+    while (count < limit) {
+      slot& tail_slot = m_slots[tail & m_mask];
+      uint64_t tail_seq = tail_slot.token.load(std::memory_order_acquire);
+      if (ticket_of(tail_seq) > tail) {
+        // a newer lap owns the slot, every ticket more than a lap behind head is lost as well
+        const uint64_t head = m_head.load(std::memory_order_relaxed);
+        tail = std::max(tail + 1, head > m_capacity ? head - m_capacity : 0);
+        continue;
+      }
+      if (tail_seq != make_token(tail, state::full))
+        break;  // not written yet, or an older lap waiting to be overwritten
+      if (!tail_slot.token.compare_exchange_strong(tail_seq, make_token(tail, state::busy),
+            std::memory_order_acquire, std::memory_order_relaxed))
+        continue;  // a producer reclaimed it first
+      T* ptr = reinterpret_cast<T*>(&tail_slot.storage);
+      T value(std::move(*ptr));
+      ptr->~T();
+      tail_slot.token.store(make_token(tail + m_capacity, state::empty), std::memory_order_release);
+      visitor(value);
+      ++tail;
+      ++count;
+    }
+    m_tail.store(tail, std::memory_order_relaxed);
+    return count;
+  }
+
+  /**
+   * @brief Blocks the consumer until a producer took a ticket or `stop` is requested.
+   */
+  void wait_for_data(const std::stop_token& stop) {
+    const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    m_parker.wait([&] { return m_head.load(std::memory_order_seq_cst) > tail; }, stop);
+  }
+
+  size_t capacity() const {
+    return m_capacity;
+  }
+
+  /**
+   * @brief Amount of elements lost to newer ones, either overwritten in place
+   * or discarded by a producer that was lapped before it could store
+   */
+  uint64_t overwritten() const {
+    return m_overwritten.load(std::memory_order_relaxed);
+  }
+
+private:
+  /**
+   * @brief state of the slot, packed into the low bits of the token
+   *
+   * empty(t) => producers with ticket >= t can construct
+   * busy(t)  => ticket t is being constructed or moved out
+   * full(t)  => ticket t can be claimed by the consumer or overwritten
+   */
+  enum class state : uint64_t {
+    empty = 0,
+    busy = 1,
+    full = 2,
+  };
+
+  static constexpr uint64_t make_token(uint64_t ticket, state st) noexcept {
+    return (ticket << 2) | static_cast<uint64_t>(st);
+  }
+
+  static constexpr uint64_t ticket_of(uint64_t token) noexcept {
+    return token >> 2;
+  }
+
+  static constexpr state state_of(uint64_t token) noexcept {
+    return static_cast<state>(token & 3);
+  }
+
+  struct slot {
+    std::atomic<uint64_t> token;
+    alignas(T) std::byte storage[sizeof(T)];
+
+    slot() : token(0) {}
+    ~slot() = default;
+  };
+
+  template <typename... Args>
+  bool emplace_impl(Args&&... args) {
+    // seq_cst pairs with the parked consumer, see ngg::mpsc::parker
+    const uint64_t head = m_head.fetch_add(1, std::memory_order_seq_cst);
+    slot& head_slot = m_slots[head & m_mask];
+    uint64_t head_seq = head_slot.token.load(std::memory_order_acquire);
+    backoff wait;
+    while (true) {
+      if (ticket_of(head_seq) > head) {
+        // lapped before storing, this element is the oldest one now
+        m_overwritten.fetch_add(1, std::memory_order_relaxed);
+        m_parker.notify();
+        return false;
+      }
+      if (state_of(head_seq) == state::busy) [[unlikely]] {
+        // an older lap is mid-construction or the consumer is moving it out, yielding in case
+        // its owner was preempted
+        wait.pause();
+        head_seq = head_slot.token.load(std::memory_order_acquire);
+        continue;
+      }
+      if (head_slot.token.compare_exchange_weak(head_seq, make_token(head, state::busy),
+            std::memory_order_acquire, std::memory_order_acquire))
+        break;
+    }
+    T* ptr = reinterpret_cast<T*>(&head_slot.storage);
+    if (state_of(head_seq) == state::full) {
+      ptr->~T();
+      m_overwritten.fetch_add(1, std::memory_order_relaxed);
+    }
+    new (ptr) T(std::forward<Args>(args)...);
+    head_slot.token.store(make_token(head, state::full), std::memory_order_release);
+    m_parker.notify();
+    return true;
+  }
+
+  slot* m_slots;
+  size_t m_capacity;
+  size_t m_mask;
+  alignas(64) std::atomic<uint64_t> m_head;
+  alignas(64) std::atomic<uint64_t> m_tail;
+  alignas(64) std::atomic<uint64_t> m_overwritten;
+  parker m_parker;
+};
+
+template <typename T>
+using overwriting_ring = overwriting_queue<T>;
+
+}  // namespace ngg::mpsc
@@ -0,0 +1,175 @@
+// FROM: https://github.com/gubnik/mpsc-queue.git
+// COPYRIGHT: GNU GPL v3 or higher, Nikolay Gubankov (nikgub)
+
+#pragma once
+
+#include "mpsc_ring.hpp"
+#include "types.hpp"
+#include "wait.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stop_token>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define NGG_MPSC_RSEQ
+#endif
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+namespace ngg::mpsc {
+
+/**
+ * @brief CPU the calling thread runs on, the answer may be stale by the time it is used
+ *
+ * Reads the `cpu_id` the kernel keeps in the thread's rseq area (glibc 2.35+
+ * registers it for every thread), which is a plain load. Falls back to
+ * `sched_getcpu`, `GetCurrentProcessorNumber`, or 0.
+ */
+inline unsigned current_cpu() noexcept {
+#if defined(NGG_MPSC_RSEQ)
+  if (__rseq_size != 0) [[likely]] {
+    const auto* area = reinterpret_cast<const volatile struct rseq*>(
+      static_cast<const char*>(__builtin_thread_pointer()) + __rseq_offset);
+    const auto cpu = static_cast<int32_t>(area->cpu_id);
+    if (cpu >= 0)
+      return static_cast<unsigned>(cpu);
+  }
+#endif
+#if defined(__linux__)
+  const int cpu = ::sched_getcpu();
+  return cpu >= 0 ? static_cast<unsigned>(cpu) : 0;
+#elif defined(_WIN32)
+  return ::GetCurrentProcessorNumber();
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @brief Bounded MPSC queue made of one @ref ngg::mpsc::lossy_queue per CPU
+ *
+ * Producers push into the ring of the CPU they run on, so memory is fixed by
+ * the core count rather than the thread count and producers only contend
+ * with threads that share their CPU. The CPU is only a hint: a thread may
+ * migrate or be preempted right after reading it, which is why every shard is
+ * still a full MPSC ring rather than a restartable per-CPU critical section.
+ * The consumer drains the rings round-robin.
+ *
+ * @tparam T inner data type
+ * @tparam Options layout of every ring, see @ref ngg::mpsc::ring_options
+ */
+template <types::trasferable T, ring_options Options = ring_options{}>
+class per_cpu_queue {
+public:
+  /**
+   * @param capacity_pow2 capacity of every CPU's ring
+   * @param storage_opts storage of every CPU's ring
+   */
+  explicit per_cpu_queue(size_t capacity_pow2, const storage_options& storage_opts = {}) {
+    const size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+    m_shards.reserve(cpus);
+    for (size_t i = 0; i < cpus; ++i)
+      m_shards.push_back(std::make_unique<lossy_queue<T, Options>>(capacity_pow2, storage_opts));
+  }
+
+  per_cpu_queue(const per_cpu_queue&) = delete;
+  per_cpu_queue& operator=(const per_cpu_queue&) = delete;
+  per_cpu_queue(per_cpu_queue&&) = delete;
+  per_cpu_queue& operator=(per_cpu_queue&&) = delete;
+
+public:
+  template <backpressure Policy = backpressure::fail>
+  bool push(const T& value) {
+    return emplace_impl<Policy>(value);
+  }
+
+  template <backpressure Policy = backpressure::fail>
+  bool push(T&& value) {
+    return emplace_impl<Policy>(std::move(value));
+  }
+
+  template <backpressure Policy = backpressure::fail, typename... Args>
+  bool emplace(Args&&... args) {
+    return emplace_impl<Policy>(std::forward<Args>(args)...);
+  }
+
+  bool try_pull(T& out) {
+    return consume([&](T& value) { out = std::move(value); }, 1) != 0;
+  }
+
+  /**
+   * @brief Visits up to `limit` ready elements in place.
+   *
+   * Drains the rings one after another, starting one ring further on every call.
+   *
+   * @param visitor callable with `void(T&)` signature, must not throw
+   * @param limit maximum amount of elements to visit
+   * @returns number of visited elements
+   */
+  template <typename F>
+  size_t consume(F&& visitor, size_t limit = std::numeric_limits<size_t>::max()) {
+    const size_t shards = m_shards.size();
+    size_t count = 0;
+    for (size_t i = 0; i < shards && count < limit; ++i)
+      count += m_shards[(m_next + i) % shards]->consume(visitor, limit - count);
+    m_next = (m_next + 1) % shards;
+    return count;
+  }
+
+  /**
+   * @brief Blocks the consumer until a producer claimed a slot or `stop` is requested.
+   *
+   * Spins, yields, then parks, see @ref ngg::mpsc::parker
+   */
+  void wait_for_data(const std::stop_token& stop) {
+    m_parker.wait(
+      [&] {
+        return std::any_of(
+          m_shards.begin(), m_shards.end(), [](const auto& shard) { return !shard->empty(); });
+      },
+      stop);
+  }
+
+  size_t shards() const {
+    return m_shards.size();
+  }
+
+  /**
+   * @brief Amount of elements rejected under @ref ngg::mpsc::backpressure::drop, summed over
+   * the shards
+   */
+  uint64_t dropped() const {
+    uint64_t total = 0;
+    for (const auto& shard : m_shards)
+      total += shard->dropped();
+    return total;
+  }
+
+private:
+  template <backpressure Policy, typename... Args>
+  bool emplace_impl(Args&&... args) {
+    // CPU ids may be sparse or hot-plugged past the count seen at construction
+    auto& shard = *m_shards[current_cpu() % m_shards.size()];
+    if (!shard.template emplace<Policy>(std::forward<Args>(args)...))
+      return false;
+    // the ring's seq_cst head CAS precedes this, see ngg::mpsc::parker
+    m_parker.notify();
+    return true;
+  }
+
+  std::vector<std::unique_ptr<lossy_queue<T, Options>>> m_shards;
+  size_t m_next = 0;  // consumer only
+  parker m_parker;    // sleeping consumer, woken by producers of every ring
+};
+
+}  // namespace ngg::mpsc
@@ -4,9 +4,15 @@
 #pragma once
 
 #include "types.hpp"
+#include "wait.hpp"
+#include <array>
 #include <atomic>
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <optional>
+#include <span>
+#include <stop_token>
 #include <type_traits>
 #include <utility>
 
@@ -15,9 +21,17 @@ namespace ngg::mpsc {
 /**
  * @brief multiple producers/single consumer queue for x86_64
  *
- * Implements Michael-Scott queue, is intrusive and unbound.
+ * Implements Michael-Scott queue, is unbound and not intrusive: elements are
+ * moved into nodes the queue owns, see @ref ngg::mpsc::intrusive_queue for
+ * objects that carry their own link.
  * Uses dummy sentinel node for initial head and tail.
  *
+ * Retired nodes are not freed but recycled: the consumer collects them in
+ * batches and hands every batch to a lock-free free list, which producers pop
+ * from before they turn to the allocator. A steady load thus allocates and
+ * frees nothing. The pool keeps up to the peak amount of nodes until
+ * @ref ngg::mpsc::stable_queue::trim or destruction.
+ *
  * @tparam T type of inner data, must be default-constructible
  * @tparam Allocator allocator type, used for inner nodes
  */
@@ -61,8 +75,8 @@ public:
      */
   ~stable_queue() {
     clear();  // leaves a single tail == head node
-    node_allocator_traits::destroy(m_node_alloc, m_head.load());
-    node_allocator_traits::deallocate(m_node_alloc, m_head.load(), 1);
+    free_node(m_head.load());
+    trim();
   }
 
 public:
@@ -96,6 +110,41 @@ public:
     emplace_impl(std::move(args)...);
   }
 
+  /**
+     * @brief Moves all `values` to the queue with a single head exchange.
+     *
+     * The nodes are linked into a private chain first, so the elements keep
+     * their order and no other producer's element lands between them. If an
+     * element throws, none is queued, the ones before it are left moved from.
+     *
+     * @param values values being moved
+     */
+  void push_bulk(std::span<T> values) {
+    if (values.empty())
+      return;
+    pointer first = nullptr;
+    pointer last = nullptr;
+    try {
+      for (T& value : values) {
+        pointer new_node = make_node(std::move(value));
+        if (first == nullptr)
+          first = new_node;
+        else
+          last->next.store(new_node, std::memory_order_relaxed);
+        last = new_node;
+      }
+    }
+    catch (...) {
+      for (pointer ptr = first; ptr != nullptr; ptr = ptr->next.load(std::memory_order_relaxed))
+        ptr->data.reset();
+      if (first != nullptr)
+        push_free(first, last);
+      m_dropped.fetch_add(values.size(), std::memory_order_relaxed);
+      throw;
+    }
+    link(first, last, values.size());
+  }
+
   /**
      * @brief Pops the first element from the queue.
      *
@@ -109,25 +158,101 @@ public:
       return std::nullopt;
     std::optional<T> result = std::move(next->data);
     m_tail.store(next, std::memory_order_release);
-    node_allocator_traits::destroy(m_node_alloc, tail_ptr);
-    node_allocator_traits::deallocate(m_node_alloc, tail_ptr, 1);
+    retire(tail_ptr);
+    count_popped(1);
     return result;
   }
 
   /**
-     * @brief Clears all the elements in the queue.
+     * @brief Blocks the consumer until a producer linked a node or `stop` is requested.
+     *
+     * Spins, yields, then parks, see @ref ngg::mpsc::parker
      */
-  void clear() {
-    pointer tail_ptr = m_tail.load(std::memory_order_relaxed);
-    while (true) {
+  void wait_for_data(const std::stop_token& stop) {
+    const pointer tail_ptr = m_tail.load(std::memory_order_relaxed);
+    m_parker.wait([&] { return m_head.load(std::memory_order_seq_cst) != tail_ptr; }, stop);
+  }
+
+  /**
+     * @brief Visits up to `limit` ready elements in place.
+     *
+     * Each element is passed to `visitor` as an lvalue and destroyed right after.
+     * Every `retire_batch` elements the tail is stored and the visited nodes go
+     * back to the pool as a single chain, so producers reuse them while the
+     * drain keeps running.
+     *
+     * @param visitor callable with `void(T&)` signature, must not throw
+     * @param limit maximum amount of elements to visit
+     * @returns number of visited elements
+     */
+  template <typename F>
+  size_t drain(F&& visitor, size_t limit = std::numeric_limits<size_t>::max()) {
+    pointer first = m_tail.load(std::memory_order_relaxed);
+    pointer last = nullptr;
+    pointer tail_ptr = first;
+    size_t count = 0;
+    size_t batch = 0;
+    while (count < limit) {
       pointer next = tail_ptr->next.load(std::memory_order_acquire);
       if (next == nullptr)
         break;
-      m_tail.store(next, std::memory_order_release);
-      node_allocator_traits::destroy(m_node_alloc, tail_ptr);
-      node_allocator_traits::deallocate(m_node_alloc, tail_ptr, 1);
-      tail_ptr = next;
+      visitor(*next->data);
+      next->data.reset();
+      last = std::exchange(tail_ptr, next);
+      ++count;
+      if (++batch == retire_batch) {
+        release_drained(first, last, tail_ptr, batch);
+        first = tail_ptr;
+        batch = 0;
+      }
     }
+    if (batch != 0)
+      release_drained(first, last, tail_ptr, batch);
+    return count;
+  }
+
+  /**
+     * @brief Clears all the elements in the queue.
+     */
+  void clear() {
+    drain([](T&) {});
+  }
+
+  /**
+     * @brief Frees every pooled node. Called by the consumer while no producer pushes.
+     *
+     * A producer popping the pool may still read a node that is freed here.
+     */
+  void trim() {
+    while (m_retired != nullptr)
+      free_node(std::exchange(m_retired, m_retired->next.load(std::memory_order_relaxed)));
+    m_retired_count = 0;
+    while (pointer pooled = pop_free())
+      free_node(pooled);
+  }
+
+  /**
+     * @brief Approximate amount of elements in the queue. Called from any thread.
+     */
+  size_t size() const {
+    const uint64_t popped = m_popped.load(std::memory_order_relaxed);
+    const uint64_t pushed = pushed_total();
+    return pushed > popped ? static_cast<size_t>(pushed - popped) : 0;
+  }
+
+  /**
+     * @brief Highest size the consumer saw, sampled every `stats_period` removed elements
+     */
+  size_t high_water() const {
+    return static_cast<size_t>(m_high_water.load(std::memory_order_relaxed));
+  }
+
+  /**
+     * @brief Amount of pushes that failed, i.e. threw from the allocator or the
+     * element constructor
+     */
+  uint64_t dropped() const {
+    return m_dropped.load(std::memory_order_relaxed);
   }
 
 protected:
@@ -158,7 +283,33 @@ private:
   //         No plans for 32bit support any time soon.
   //         TODO: maybe fix this?
   alignas(64) atomic_node m_head;  // nikgub: newest node
-  alignas(64) atomic_node m_tail;  // nikgub: oldest node
+  // statistics, off the head line
+  alignas(64) std::atomic<uint64_t> m_dropped = 0;
+  alignas(64) atomic_node m_tail;          // nikgub: oldest node
+  std::atomic<uint64_t> m_popped = 0;      // written by the consumer
+  std::atomic<uint64_t> m_high_water = 0;  // written by the consumer
+  pointer m_retired = nullptr;             // consumer only, next batch for the free list
+  pointer m_retired_last = nullptr;
+  size_t m_retired_count = 0;
+  parker m_parker;                         // sleeping consumer, woken by producers
+  // top of the free list, the node pointer in the low bits and an ABA tag in the top bits
+  alignas(64) std::atomic<uint64_t> m_free = 0;
+
+  struct alignas(64) push_counter {
+    std::atomic<uint64_t> value = 0;
+  };
+
+  // pushed elements, sharded by producer thread and summed on read
+  static constexpr size_t push_shards = 16;
+  std::array<push_counter, push_shards> m_pushed;
+
+  static constexpr uint64_t stats_period = 64;
+  // retired nodes handed to the free list with a single CAS
+  static constexpr size_t retire_batch = 32;
+  // user space addresses of x86_64 and aarch64 fit into 48 bits
+  static constexpr unsigned tag_shift = 48;
+  static constexpr uint64_t pointer_mask = (uint64_t{1} << tag_shift) - 1;
+  static_assert(sizeof(pointer) == sizeof(uint64_t), "the free list needs 64 bit pointers");
 
 private:
   /**
@@ -172,12 +323,161 @@ private:
      */
   template <typename... Args>
   void emplace_impl(Args&&... args) {
-    pointer new_node = node_allocator_traits::allocate(m_node_alloc, 1);
-    node_allocator_traits::construct(m_node_alloc, new_node, nullptr, std::forward<Args>(args)...);
+    pointer new_node = nullptr;
+    try {
+      new_node = make_node(std::forward<Args>(args)...);
+    }
+    catch (...) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      throw;
+    }
+    link(new_node, new_node, 1);
+  }
+
+  /**
+     * @brief Appends a chain of nodes linked through `next` with a single head exchange.
+     */
+  void link(pointer first, pointer last, size_t count) noexcept {
     // nikgub: contested but fine
     // TODO: find a test where it fails
-    pointer prev_head = m_head.exchange(new_node, std::memory_order_acq_rel);
-    prev_head->next.store(new_node, std::memory_order_release);
+    // seq_cst pairs with the parked consumer, see ngg::mpsc::parker
+    pointer prev_head = m_head.exchange(last, std::memory_order_seq_cst);
+    // releases the whole chain, its inner links were stored before
+    prev_head->next.store(first, std::memory_order_release);
+    // only producers sharing the shard contend, unlike on a single counter
+    m_pushed[producer_shard()].value.fetch_add(count, std::memory_order_relaxed);
+    m_parker.notify();
+  }
+
+  /**
+     * @brief Shard of the calling thread, threads take consecutive ones in order of first push.
+     */
+  static size_t producer_shard() noexcept {
+    static std::atomic<size_t> next_shard = 0;
+    thread_local const size_t shard =
+      next_shard.fetch_add(1, std::memory_order_relaxed) % push_shards;
+    return shard;
+  }
+
+  uint64_t pushed_total() const noexcept {
+    uint64_t total = 0;
+    for (const push_counter& counter : m_pushed)
+      total += counter.value.load(std::memory_order_relaxed);
+    return total;
+  }
+
+  /**
+     * @brief Constructs an element in a pooled node, or in a new one if the pool is empty.
+     */
+  template <typename... Args>
+  pointer make_node(Args&&... args) {
+    pointer new_node = pop_free();
+    if (new_node == nullptr) [[unlikely]]
+      return allocate_node(std::forward<Args>(args)...);
+    try {
+      new_node->data.emplace(std::forward<Args>(args)...);
+    }
+    catch (...) {
+      push_free(new_node, new_node);
+      throw;
+    }
+    new_node->next.store(nullptr, std::memory_order_relaxed);
+    return new_node;
+  }
+
+  template <typename... Args>
+  pointer allocate_node(Args&&... args) {
+    pointer new_node = node_allocator_traits::allocate(m_node_alloc, 1);
+    try {
+      node_allocator_traits::construct(
+        m_node_alloc, new_node, nullptr, std::forward<Args>(args)...);
+    }
+    catch (...) {
+      node_allocator_traits::deallocate(m_node_alloc, new_node, 1);
+      throw;
+    }
+    return new_node;
+  }
+
+  void free_node(pointer ptr) noexcept {
+    node_allocator_traits::destroy(m_node_alloc, ptr);
+    node_allocator_traits::deallocate(m_node_alloc, ptr, 1);
+  }
+
+  static uint64_t pack(pointer ptr, uint64_t tag) noexcept {
+    return reinterpret_cast<uintptr_t>(ptr) | (tag << tag_shift);
+  }
+
+  static pointer unpack(uint64_t word) noexcept {
+    return reinterpret_cast<pointer>(static_cast<uintptr_t>(word & pointer_mask));
+  }
+
+  /**
+     * @brief Pops a pooled node, nullptr if the pool is empty. Called from any thread.
+     *
+     * The node stays constructed with an empty `data`. Its `next` may be read
+     * while another thread already reuses it, the tag then fails the CAS.
+     */
+  pointer pop_free() noexcept {
+    uint64_t top = m_free.load(std::memory_order_acquire);
+    while (pointer ptr = unpack(top)) {
+      const pointer next = ptr->next.load(std::memory_order_relaxed);
+      if (m_free.compare_exchange_weak(top, pack(next, (top >> tag_shift) + 1),
+            std::memory_order_acquire, std::memory_order_acquire))
+        return ptr;
+    }
+    return nullptr;
+  }
+
+  /**
+     * @brief Pushes a chain of nodes linked through `next` onto the pool.
+     */
+  void push_free(pointer first, pointer last) noexcept {
+    uint64_t top = m_free.load(std::memory_order_relaxed);
+    do
+      last->next.store(unpack(top), std::memory_order_relaxed);
+    while (!m_free.compare_exchange_weak(top, pack(first, (top >> tag_shift) + 1),
+      std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  /**
+     * @brief Empties a node the consumer is done with and queues it for the pool.
+     */
+  void retire(pointer ptr) noexcept {
+    ptr->data.reset();
+    ptr->next.store(m_retired, std::memory_order_relaxed);
+    if (m_retired == nullptr)
+      m_retired_last = ptr;
+    m_retired = ptr;
+    if (++m_retired_count == retire_batch) {
+      push_free(m_retired, m_retired_last);
+      m_retired = nullptr;
+      m_retired_count = 0;
+    }
+  }
+
+  /**
+     * @brief Makes `tail` the dummy and pools the drained chain `first` -> ... -> `last`.
+     */
+  void release_drained(pointer first, pointer last, pointer tail, size_t count) noexcept {
+    first->data.reset();  // moved from if pull made it the dummy
+    m_tail.store(tail, std::memory_order_release);
+    push_free(first, last);
+    count_popped(count);
+  }
+
+  /**
+     * @brief Advances the consumer's counters, samples the high-water mark.
+     */
+  void count_popped(uint64_t count) noexcept {
+    const uint64_t before = m_popped.load(std::memory_order_relaxed);
+    m_popped.store(before + count, std::memory_order_relaxed);
+    if ((before + count) / stats_period != before / stats_period) {
+      // the backlog the batch started from, a large drain leaves none behind
+      const uint64_t pushed = pushed_total();
+      if (pushed > before && pushed - before > m_high_water.load(std::memory_order_relaxed))
+        m_high_water.store(pushed - before, std::memory_order_relaxed);
+    }
   }
 };
 
@@ -3,58 +3,110 @@
 
 #pragma once
 
+#include "storage.hpp"
 #include "types.hpp"
+#include "wait.hpp"
+#include <algorithm>
 #include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
 #include <cstdint>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <new>
+#include <span>
+#include <stdexcept>
+#include <stop_token>
+#include <type_traits>
 #include <utility>
 
 namespace ngg::mpsc {
 
 /**
- * @brief Lossy MPSC wait-free queue based on a ring buffer for x86_64
+ * @brief Memory layout of the ring slots
+ */
+enum class slot_layout {
+  packed,  // token next to the element, slots may straddle cache lines
+  padded,  // token next to the element, every slot rounded up to whole cache lines
+  split,   // tokens and elements in two separate arrays
+};
+
+/**
+ * @brief Compile-time options of @ref ngg::mpsc::lossy_queue
+ */
+struct ring_options {
+  slot_layout layout = slot_layout::packed;
+  // power of two fixed at compile time with the slots embedded into the queue, 0 for a runtime
+  // capacity on separately allocated storage
+  size_t capacity = 0;
+  // maps consecutive tickets to slots a fraction of the ring apart instead of neighbouring ones
+  bool scramble = false;
+  // slots the consumer prefetches ahead of the one it reads, 0 disables prefetching
+  size_t prefetch = 0;
+};
+
+/**
+ * @brief Copy of `options` with a compile-time `capacity`, every other option kept
+ */
+constexpr ring_options with_capacity(ring_options options, size_t capacity) noexcept {
+  options.capacity = capacity;
+  return options;
+}
+
+/**
+ * @brief Lossy MPSC lock-free queue based on a ring buffer for x86_64
  *
  * Generally at least 20% faster than @ref ngg::mpsc::stable_queue on smaller
  * sizes and up to 400% faster on large sizes (default allocator)
  * Very fast at the cost of extreme memory overhead.
  *
  * Uses token contract for wait-free element access, see @
- * ngg::mpsc::lossy_queue::slot
+ * ngg::mpsc::lossy_queue::slot. Producers claim tickets with a CAS only after
+ * the slot was seen free, so a full queue never consumes a ticket. What happens
+ * then is chosen per call with @ref ngg::mpsc::backpressure.
+ *
+ * Storage is a single zero-filled block, and a zeroed token marks its slot free
+ * for the first lap, so with @ref ngg::mpsc::storage_init::lazy the constructor
+ * touches no slot at all and pages are faulted in as the ring is first used.
+ *
+ * With a compile-time `Options.capacity` the slots live inside the queue object
+ * and the wrap arithmetic folds into constants, so small rings can be embedded
+ * into other objects without any allocation, see @ref ngg::mpsc::fixed_ring
  *
  * @tparam T inner data type
+ * @tparam Options compile-time options, see @ref ngg::mpsc::ring_options
  */
-template <types::trasferable T>
+template <types::trasferable T, ring_options Options = ring_options{}>
 class lossy_queue {
+  static constexpr bool fixed = Options.capacity != 0;
+  static_assert(!fixed || (Options.capacity >= 2 && std::has_single_bit(Options.capacity)),
+    "Capacity must be power of two >= 2");
+
 public:
-  explicit lossy_queue(size_t capacity_pow2) {
-    size_t cap = capacity_pow2;
-    if (cap < 2 || (cap & (cap - 1)) != 0)
-      throw std::invalid_argument("Capacity must be power of two >= 2");
-    m_capacity = cap;
-    m_mask = m_capacity - 1;
-    m_slots = static_cast<slot*>(::operator new[](sizeof(slot) * m_capacity));
-    for (size_t i = 0; i < m_capacity; ++i) {
-      new (&m_slots[i]) slot();
-      m_slots[i].token.store(i, std::memory_order_relaxed);
-    }
-    m_head.store(0, std::memory_order_relaxed);
-    m_tail.store(0, std::memory_order_relaxed);
+  // zero bytes already are free slots, see ngg::mpsc::lossy_queue::slot
+  explicit lossy_queue(size_t capacity_pow2, const storage_options& storage_opts = {})
+    requires(!fixed)
+    : m_block(checked_capacity(capacity_pow2), storage_opts) {
+    init();
+  }
+
+  lossy_queue()
+    requires(fixed)
+  {
+    init();
   }
 
   ~lossy_queue() {
     uint64_t t = m_tail.load(std::memory_order_relaxed);
     uint64_t h = m_head.load(std::memory_order_relaxed);
     while (t != h) {
-      slot& s = m_slots[t & m_mask];
-      T* ptr = reinterpret_cast<T*>(&s.storage);
-      ptr->~T();
+      // only published slots own an element, holes and claimed tickets do not
+      if (load_token(t, std::memory_order_relaxed) == t + 1)
+        element(t)->~T();
       ++t;
     }
-    for (size_t i = 0; i < m_capacity; ++i)
-      m_slots[i].~slot();
-    ::operator delete[](m_slots);
   }
 
   lossy_queue(const lossy_queue&) = delete;
@@ -63,38 +115,290 @@ public:
   lossy_queue& operator=(lossy_queue&&) = delete;
 
 public:
+  class reservation;
+
+  template <backpressure Policy = backpressure::fail>
   bool push(const T& value) {
-    return emplace_impl(value);
+    return emplace_impl<Policy>(value);
   }
 
+  template <backpressure Policy = backpressure::fail>
   bool push(T&& value) {
-    return emplace_impl(std::move(value));
+    return emplace_impl<Policy>(std::move(value));
   }
 
-  template <typename... Args>
+  template <backpressure Policy = backpressure::fail, typename... Args>
   bool emplace(Args&&... args) {
-    return emplace_impl(std::forward<Args>(args)...);
+    return emplace_impl<Policy>(std::forward<Args>(args)...);
   }
 
-  bool try_pull(T& out) {
-    uint64_t tail = m_tail.load(std::memory_order_relaxed);
-    slot& tail_slot = m_slots[tail & m_mask];
-    uint64_t tail_seq = tail_slot.token.load(std::memory_order_acquire);
-    if (tail_seq != tail + 1)
+  /**
+   * @brief Constructs an element, sleeping while the queue is full.
+   *
+   * The producer parks on a futex tied to the consumer's progress, see
+   * @ref ngg::mpsc::waiters
+   *
+   * @param stop cancels the wait
+   * @param deadline point in time after which the producer gives up
+   * @param args constructor args
+   * @returns false if the element was not queued, which is not counted in `dropped()`
+   */
+  template <typename... Args>
+  bool emplace_until(const std::stop_token& stop, waiters::clock::time_point deadline,
+    Args&&... args) {
+    uint64_t head = 0;
+    if (!claim_until(head, 1, stop, deadline))
       return false;
-    T* ptr = reinterpret_cast<T*>(&tail_slot.storage);
-    out = std::move(*ptr);
-    ptr->~T();
-    tail_slot.token.store(tail + m_capacity, std::memory_order_release);
-    m_tail.store(tail + 1, std::memory_order_relaxed);
+    construct(head, std::forward<Args>(args)...);
     return true;
   }
 
+  template <typename Rep, typename Period, typename... Args>
+  bool emplace_for(const std::stop_token& stop, std::chrono::duration<Rep, Period> timeout,
+    Args&&... args) {
+    return emplace_until(stop, waiters::clock::now() + timeout, std::forward<Args>(args)...);
+  }
+
+  /**
+   * @brief Claims `count` contiguous slots with a single head update.
+   *
+   * The returned @ref ngg::mpsc::lossy_queue::reservation is empty if the slots
+   * could not be claimed under `Policy`, or if `count` exceeds the capacity.
+   *
+   * @tparam Policy behaviour when fewer than `count` slots are free
+   * @param count amount of slots to claim
+   */
+  template <backpressure Policy = backpressure::fail>
+  reservation reserve(size_t count) {
+    if (count == 0)
+      return {};
+    if (count > capacity()) {
+      if constexpr (Policy == backpressure::drop)
+        m_dropped.fetch_add(count, std::memory_order_relaxed);
+      return {};
+    }
+    uint64_t head = 0;
+    if (!claim<Policy>(head, count))
+      return {};
+    return reservation(this, head, count);
+  }
+
+  bool try_pull(T& out) {
+    return consume([&](T& value) { out = std::move(value); }, 1) != 0;
+  }
+
+  /**
+   * @brief Moves up to `out.size()` ready elements into `out`.
+   *
+   * Walks consecutive ready slots in a single pass and publishes the tail once,
+   * see @ref ngg::mpsc::lossy_queue::consume
+   *
+   * @param out destination span, elements are move-assigned
+   * @returns number of elements written to the front of `out`
+   */
+  size_t try_pull_bulk(std::span<T> out) {
+    size_t count = 0;
+    consume([&](T& value) { out[count++] = std::move(value); }, out.size());
+    return count;
+  }
+
+  /**
+   * @brief Visits up to `limit` ready elements in place.
+   *
+   * Each element is passed to `visitor` as an lvalue and destroyed right after,
+   * its slot is handed back to producers immediately. The consumer tail is stored
+   * and blocked producers are woken every quarter of the ring and at the end of
+   * the call, instead of once per element.
+   *
+   * With `Options.prefetch` the token and element `prefetch` slots ahead are
+   * requested while the current one is visited, as long as that slot was already
+   * claimed, so the misses on lines producers just wrote on other cores overlap.
+   *
+   * @param visitor callable with `void(T&)` signature, must not throw
+   * @param limit maximum amount of elements to visit
+   * @returns number of visited elements
+   */
+  template <typename F>
+  size_t consume(F&& visitor, size_t limit = std::numeric_limits<size_t>::max()) {
+    const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    const uint64_t head = m_head.load(std::memory_order_relaxed);  // statistics only
+    uint64_t pos = tail;
+    uint64_t published = tail;
+    size_t count = 0;
+    while (count < limit) {
+      if constexpr (Options.prefetch != 0)
+        if (pos + Options.prefetch < head)
+          prefetch(pos + Options.prefetch);
+      const uint64_t tail_seq = load_token(pos, std::memory_order_acquire);
+      if (tail_seq == pos + 1) {
+        T* ptr = element(pos);
+        visitor(*ptr);
+        ptr->~T();
+        ++count;
+      }
+      else if (tail_seq != ((pos + 1) | hole_bit))
+        break;
+      store_token(pos, pos + capacity(), std::memory_order_release);
+      ++pos;
+      if (pos - published >= capacity() / 4) {
+        release_space(pos);
+        published = pos;
+      }
+    }
+    if (pos != published)
+      release_space(pos);
+    if (head - tail > m_high_water.load(std::memory_order_relaxed))
+      m_high_water.store(head - tail, std::memory_order_relaxed);
+    m_lag.store(head > pos ? head - pos : 0, std::memory_order_relaxed);
+    return count;
+  }
+
+  /**
+   * @brief Blocks the consumer until a producer claimed a slot or `stop` is requested.
+   *
+   * Spins, yields, then parks, see @ref ngg::mpsc::parker
+   */
+  void wait_for_data(const std::stop_token& stop) {
+    const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    m_parker.wait([&] { return m_head.load(std::memory_order_seq_cst) != tail; }, stop);
+  }
+
+  /**
+   * @brief Checks for claimed slots, published or not. Called by the consumer only.
+   */
+  bool empty() const {
+    return m_head.load(std::memory_order_seq_cst) == m_tail.load(std::memory_order_relaxed);
+  }
+
   size_t capacity() const {
-    return m_capacity;
+    if constexpr (fixed)
+      return Options.capacity;
+    else
+      return m_block.capacity;
+  }
+
+  /**
+   * @brief NUMA node the slots are bound to, -1 if they are not bound to a single one
+   */
+  int numa_node() const {
+    if constexpr (fixed)
+      return -1;
+    else
+      return m_block.memory.numa_node();
+  }
+
+  /**
+   * @brief Approximate amount of claimed slots, published or not. Called from any thread.
+   */
+  size_t size() const {
+    const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    const uint64_t head = m_head.load(std::memory_order_relaxed);
+    return head > tail ? static_cast<size_t>(std::min<uint64_t>(head - tail, capacity())) : 0;
+  }
+
+  /**
+   * @brief Highest occupancy the consumer saw at the start of a consume pass
+   */
+  size_t high_water() const {
+    return static_cast<size_t>(m_high_water.load(std::memory_order_relaxed));
   }
 
+  /**
+   * @brief Tickets the last consume pass left behind, claimed by producers but not consumed
+   */
+  uint64_t lag() const {
+    return m_lag.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Amount of elements rejected under @ref ngg::mpsc::backpressure::drop
+   */
+  uint64_t dropped() const {
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Contiguous slots claimed by a single producer.
+   *
+   * Obtained from @ref ngg::mpsc::lossy_queue::reserve. Elements are constructed
+   * in order with `emplace` and become visible to the consumer on `commit` or
+   * destruction, whichever comes first. Slots left unconstructed at that point
+   * are published as holes, which the consumer skips.
+   */
+  class reservation {
+  public:
+    reservation() = default;
+
+    reservation(reservation&& other) noexcept :
+      m_queue(std::exchange(other.m_queue, nullptr)), m_head(other.m_head), m_size(other.m_size),
+      m_constructed(other.m_constructed) {}
+
+    reservation& operator=(reservation&& other) noexcept {
+      if (this != &other) {
+        commit();
+        m_queue = std::exchange(other.m_queue, nullptr);
+        m_head = other.m_head;
+        m_size = other.m_size;
+        m_constructed = other.m_constructed;
+      }
+      return *this;
+    }
+
+    ~reservation() {
+      commit();
+    }
+
+    explicit operator bool() const noexcept {
+      return m_queue != nullptr;
+    }
+
+    size_t size() const noexcept {
+      return m_size;
+    }
+
+    /**
+     * @brief Constructs the next reserved element from provided args.
+     */
+    template <typename... Args>
+    void emplace(Args&&... args) {
+      assert(m_queue != nullptr && m_constructed < m_size);
+      new (m_queue->element(m_head + m_constructed)) T(std::forward<Args>(args)...);
+      ++m_constructed;
+    }
+
+    /**
+     * @brief Publishes every reserved slot to the consumer, leaves the reservation empty.
+     */
+    void commit() noexcept {
+      if (m_queue == nullptr)
+        return;
+      for (size_t i = 0; i < m_size; ++i) {
+        const uint64_t ticket = m_head + i;
+        const uint64_t token = i < m_constructed ? ticket + 1 : (ticket + 1) | hole_bit;
+        m_queue->store_token(ticket, token, std::memory_order_release);
+      }
+      m_queue->m_parker.notify();
+      m_queue = nullptr;
+    }
+
+  private:
+    friend class lossy_queue;
+
+    reservation(lossy_queue* queue, uint64_t head, size_t size) :
+      m_queue(queue), m_head(head), m_size(size) {}
+
+    lossy_queue* m_queue = nullptr;
+    uint64_t m_head = 0;
+    size_t m_size = 0;
+    size_t m_constructed = 0;
+  };
+
 private:
+  // set on a published token whose slot was reserved but never constructed
+  static constexpr uint64_t hole_bit = uint64_t{1} << 63;
+
+  static constexpr bool split = Options.layout == slot_layout::split;
+
   struct slot {
     /**
          * @brief token of the slot
@@ -102,39 +406,282 @@ private:
          * seq == idx       => producer can construct
          * seq == idx + 1   => consumer can claim
          * seq >= idx + cap => consumer claimed
+         * seq == (idx + 1) | hole_bit => consumer skips
+         *
+         * Stored minus the ticket's position in the ring, `idx & mask`, so the
+         * all-zero slot is free for lap 0. See @ref ngg::mpsc::lossy_queue::load_token
          */
     std::atomic<uint64_t> token;
     alignas(T) std::byte storage[sizeof(T)];
+  };
+
+  // slots are never constructed, zero-filled storage must already be valid tokens
+  static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+    std::is_trivially_destructible_v<std::atomic<uint64_t>>);
+
+  // keeps neighbouring slots off each other's cache lines
+  struct alignas(64) padded_slot : slot {};
 
-    slot() : token(0) {}
-    ~slot() = default;
+  // element storage of the split layout, tokens live in their own array
+  struct cell {
+    alignas(T) std::byte storage[sizeof(T)];
   };
 
-  template <typename... Args>
+  using slot_type = std::conditional_t<Options.layout == slot_layout::padded, padded_slot, slot>;
+
+  static constexpr size_t storage_alignment =
+    std::max({size_t{64}, alignof(slot_type), alignof(cell)});
+
+  static constexpr size_t tokens_size(size_t capacity) noexcept {
+    const size_t bytes = sizeof(std::atomic<uint64_t>) * capacity;
+    return (bytes + storage_alignment - 1) / storage_alignment * storage_alignment;
+  }
+
+  static size_t checked_capacity(size_t capacity) {
+    if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+      throw std::invalid_argument("Capacity must be power of two >= 2");
+    return capacity;
+  }
+
+  static constexpr size_t storage_size(size_t capacity) noexcept {
+    if constexpr (split)
+      return tokens_size(capacity) + sizeof(cell) * capacity;
+    else
+      return sizeof(slot_type) * capacity;
+  }
+
+  // slots of a runtime capacity, separately allocated
+  struct heap_block {
+    heap_block(size_t capacity_pow2, const storage_options& storage_opts) :
+      capacity(capacity_pow2), memory(storage_size(capacity), storage_alignment, storage_opts) {}
+
+    void* data() const noexcept {
+      return memory.data();
+    }
+
+    size_t capacity;
+    storage memory;
+  };
+
+  // slots of a compile-time capacity, embedded into the queue
+  struct embedded_block {
+    void* data() noexcept {
+      return bytes;
+    }
+
+    alignas(storage_alignment) std::byte bytes[storage_size(fixed ? Options.capacity : 2)] = {};
+  };
+
+  using block_type = std::conditional_t<fixed, embedded_block, heap_block>;
+
+  size_t mask() const noexcept {
+    return capacity() - 1;
+  }
+
+  slot_type* slots() noexcept {  // packed and padded layouts
+    return static_cast<slot_type*>(m_block.data());
+  }
+
+  std::atomic<uint64_t>* tokens() noexcept {  // split layout
+    return static_cast<std::atomic<uint64_t>*>(m_block.data());
+  }
+
+  cell* cells() noexcept {  // split layout
+    return reinterpret_cast<cell*>(static_cast<std::byte*>(m_block.data()) + tokens_size(capacity()));
+  }
+
+  // 16 consecutive tickets, one per producer of the reference workload, land on distinct lines
+  static constexpr unsigned scramble_bits = 4;
+
+  // scramble of a compile-time capacity, static so that index() folds it into immediates
+  struct fixed_scramble {
+    static constexpr auto capacity_bits =
+      static_cast<unsigned>(std::countr_zero(fixed ? Options.capacity : size_t{2}));
+    static constexpr unsigned bits = std::min(scramble_bits, capacity_bits - 1);
+    static constexpr unsigned shift = capacity_bits - bits;
+  };
+
+  // scramble of a runtime capacity, set by init()
+  struct runtime_scramble {
+    unsigned bits = 0;
+    unsigned shift = 0;
+  };
+
+  using scramble_type = std::conditional_t<fixed, fixed_scramble, runtime_scramble>;
+
+  void init() noexcept {
+    if constexpr (Options.scramble && !fixed) {
+      const auto capacity_bits = static_cast<unsigned>(std::countr_zero(capacity()));
+      m_scramble.bits = std::min(scramble_bits, capacity_bits - 1);
+      m_scramble.shift = capacity_bits - m_scramble.bits;
+    }
+    m_head.store(0, std::memory_order_relaxed);
+    m_tail.store(0, std::memory_order_relaxed);
+    m_dropped.store(0, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Maps a ticket to its slot.
+   *
+   * With `Options.scramble` the low bits of the ring index are rotated to the
+   * top, so ticket `t + 1` lands `capacity >> scramble_bits` slots after `t`.
+   * The mapping is a bijection that repeats every lap, so a slot still serves
+   * tickets `idx`, `idx + cap`, ... and the token protocol is unchanged.
+   */
+  size_t index(uint64_t ticket) const noexcept {
+    const size_t idx = ticket & mask();
+    if constexpr (Options.scramble)
+      return ((idx & ((size_t{1} << m_scramble.bits) - 1)) << m_scramble.shift) |
+        (idx >> m_scramble.bits);
+    else
+      return idx;
+  }
+
+  std::atomic<uint64_t>& token(uint64_t ticket) noexcept {
+    if constexpr (split)
+      return tokens()[index(ticket)];
+    else
+      return slots()[index(ticket)].token;
+  }
+
+  /**
+   * @brief Publishes the consumer tail and wakes producers blocked on a full ring.
+   */
+  void release_space(uint64_t pos) noexcept {
+    m_tail.store(pos, std::memory_order_relaxed);
+    m_space.notify_fenced();
+  }
+
+  /**
+   * @brief Reads the token of the ticket's slot, undoing the zero-based offset.
+   */
+  uint64_t load_token(uint64_t ticket, std::memory_order order) noexcept {
+    return token(ticket).load(order) + (ticket & mask());
+  }
+
+  void store_token(uint64_t ticket, uint64_t value, std::memory_order order) noexcept {
+    token(ticket).store(value - (ticket & mask()), order);
+  }
+
+  T* element(uint64_t ticket) noexcept {
+    if constexpr (split)
+      return reinterpret_cast<T*>(&cells()[index(ticket)].storage);
+    else
+      return reinterpret_cast<T*>(&slots()[index(ticket)].storage);
+  }
+
+  /**
+   * @brief Requests the ticket's token and element lines for reading.
+   *
+   * Read rather than write intent: the slot may still be written by its
+   * producer, which would otherwise lose the line to the consumer mid-write.
+   */
+  void prefetch(uint64_t ticket) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(&token(ticket), 0, 3);
+    __builtin_prefetch(element(ticket), 0, 3);
+#elif defined(_M_X64)
+    _mm_prefetch(reinterpret_cast<const char*>(&token(ticket)), _MM_HINT_T0);
+    _mm_prefetch(reinterpret_cast<const char*>(element(ticket)), _MM_HINT_T0);
+#endif
+  }
+
+  /**
+   * @brief Claims `count` contiguous tickets if their slots are free.
+   *
+   * Only the last slot is inspected: the consumer frees slots in ticket order,
+   * so the rest of the range is free whenever the last one is. Nothing is
+   * claimed when the queue is full.
+   */
+  bool try_claim(uint64_t& head, size_t count) {
+    head = m_head.load(std::memory_order_relaxed);
+    while (true) {
+      const uint64_t last = head + count - 1;
+      // a hole is a published ticket to the producers, claimed by another one or still queued
+      const uint64_t last_seq = load_token(last, std::memory_order_acquire) & ~hole_bit;
+      const auto diff = static_cast<int64_t>(last_seq - last);
+      if (diff == 0) {
+        // seq_cst pairs with the parked consumer, see ngg::mpsc::parker
+        if (m_head.compare_exchange_weak(head, head + count, std::memory_order_seq_cst,
+              std::memory_order_relaxed))
+          return true;
+      }
+      else if (diff < 0)
+        return false;  // previous lap is still there, the queue is full
+      else
+        head = m_head.load(std::memory_order_relaxed);  // claimed by another producer
+    }
+  }
+
+  /**
+   * @brief Claims `count` tickets, backs off and then sleeps while the queue is full.
+   */
+  bool claim_until(uint64_t& head, size_t count, const std::stop_token& stop,
+    waiters::clock::time_point deadline) {
+    if (try_claim(head, count)) [[likely]]
+      return true;
+    backoff wait;
+    while (!wait.exhausted()) {
+      wait.pause();
+      if (try_claim(head, count))
+        return true;
+    }
+    return m_space.wait_until([&] { return try_claim(head, count); }, stop, deadline);
+  }
+
+  template <backpressure Policy>
+  bool claim(uint64_t& head, size_t count) {
+    if constexpr (Policy == backpressure::block)
+      return claim_until(head, count, {}, waiters::clock::time_point::max());
+    if (try_claim(head, count)) [[likely]]
+      return true;
+    if constexpr (Policy == backpressure::spin) {
+      backoff wait;
+      while (!wait.exhausted()) {
+        wait.pause();
+        if (try_claim(head, count))
+          return true;
+      }
+    }
+    if constexpr (Policy == backpressure::drop)
+      m_dropped.fetch_add(count, std::memory_order_relaxed);
+    return false;
+  }
+
+  template <backpressure Policy, typename... Args>
   bool emplace_impl(Args&&... args) {
-    uint64_t head = m_head.fetch_add(1, std::memory_order_relaxed);
-    slot& head_slot = m_slots[head & m_mask];
-    uint64_t head_seq = head_slot.token.load(std::memory_order_acquire);
-    if (head_seq != head) {
-      // TODO: implement dropping mechanism, or don't. dropping introduces
-      // a lot of overhead, not sure if it is needed. may be a candidate
-      // for a separate class.
+    uint64_t head = 0;
+    if (!claim<Policy>(head, 1))
       return false;
-    }
-    T* ptr = reinterpret_cast<T*>(&head_slot.storage);
-    new (ptr) T(std::forward<Args>(args)...);
-    head_slot.token.store(head + 1, std::memory_order_release);
+    construct(head, std::forward<Args>(args)...);
     return true;
   }
 
-  slot* m_slots;
-  size_t m_capacity;
-  size_t m_mask;
+  template <typename... Args>
+  void construct(uint64_t head, Args&&... args) {
+    new (element(head)) T(std::forward<Args>(args)...);
+    store_token(head, head + 1, std::memory_order_release);
+    m_parker.notify();
+  }
+
+  block_type m_block;
+  [[no_unique_address]] scramble_type m_scramble;
   alignas(64) std::atomic<uint64_t> m_head;
   alignas(64) std::atomic<uint64_t> m_tail;
+  std::atomic<uint64_t> m_high_water = 0;  // written by the consumer
+  std::atomic<uint64_t> m_lag = 0;         // written by the consumer
+  alignas(64) std::atomic<uint64_t> m_dropped;
+  parker m_parker;   // sleeping consumer, woken by producers
+  waiters m_space;  // sleeping producers, woken by the consumer
 };
 
-template <typename T>
-using ring = lossy_queue<T>;
+template <typename T, ring_options Options = ring_options{}>
+using ring = lossy_queue<T, Options>;
+
+/**
+ * @brief Ring with a compile-time capacity, embedded without allocation
+ */
+template <typename T, size_t Capacity, ring_options Options = ring_options{}>
+using fixed_ring = lossy_queue<T, with_capacity(Options, Capacity)>;
 
 }  // namespace ngg::mpsc
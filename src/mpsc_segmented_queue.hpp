@@ -0,0 +1,360 @@
+// FROM: https://github.com/gubnik/mpsc-queue.git
+// COPYRIGHT: GNU GPL v3 or higher, Nikolay Gubankov (nikgub)
+
+#pragma once
+
+#include "types.hpp"
+#include "wait.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <stop_token>
+#include <utility>
+#include <vector>
+
+namespace ngg::mpsc {
+
+/**
+ * @brief Unbounded MPSC queue made of linked ring segments for x86_64
+ *
+ * Middle ground between @ref ngg::mpsc::lossy_queue and
+ * @ref ngg::mpsc::stable_queue: producers claim slots inside the current
+ * segment with a single fetch_add, memory grows one segment at a time with
+ * the load, and nothing is ever dropped.
+ *
+ * The head is a single word holding the current segment pointer in the high
+ * bits and the claim index in the low bits, which is why segments are aligned
+ * to a power of two above their slot count plus `MaxProducers`. A producer
+ * therefore never dereferences a segment it did not claim a slot in, and the
+ * consumer may recycle a segment as soon as it drained it. The producer that
+ * claims the first index past the end links the next segment. A producer only
+ * increments an index it saw open, so each producer thread overshoots a full
+ * segment at most once before it waits for the new one.
+ *
+ * To keep the index clear of the pointer bits, a thread registers with the
+ * queue on its first push and leaves when it exits. Registering more than
+ * `MaxProducers` live threads throws instead of risking the head word.
+ *
+ * Drained segments go back to a small pool, so a steady load allocates nothing.
+ *
+ * @tparam T inner data type
+ * @tparam SegmentSize amount of slots per segment, a power of two
+ * @tparam Allocator allocator type, used for segments, must honour their extended alignment
+ * @tparam MaxProducers live threads that may push, segments are aligned to fit
+ * `SegmentSize + MaxProducers` claim indices
+ */
+template <types::trasferable T, size_t SegmentSize = 1'024,
+  types::minimal_allocator_type<T> Allocator = std::allocator<T>, size_t MaxProducers = 256>
+class segmented_queue {
+  // smaller segments make producers wait on the linking one too often
+  static_assert(SegmentSize >= 8 && std::has_single_bit(SegmentSize),
+    "SegmentSize must be a power of two >= 8");
+
+public:
+  static constexpr size_t max_producers = MaxProducers;
+
+  segmented_queue() : m_segment_alloc() {
+    segment* first = make_segment();
+    m_tail_segment = first;
+    m_head.store(encode(first, 0), std::memory_order_relaxed);
+  }
+
+  ~segmented_queue() {
+    consume([](T&) {});
+    free_segment(m_tail_segment);
+    for (size_t i = m_pool_tail.load(std::memory_order_relaxed);
+      i != m_pool_head.load(std::memory_order_relaxed); ++i)
+      free_segment(m_pool[i % pool_size].load(std::memory_order_relaxed));
+  }
+
+  segmented_queue(const segmented_queue&) = delete;
+  segmented_queue& operator=(const segmented_queue&) = delete;
+  segmented_queue(segmented_queue&&) = delete;
+  segmented_queue& operator=(segmented_queue&&) = delete;
+
+public:
+  /**
+   * @throws std::length_error if the calling thread would be producer number `MaxProducers + 1`
+   */
+  void push(const T& value) {
+    emplace_impl(value);
+  }
+
+  void push(T&& value) {
+    emplace_impl(std::move(value));
+  }
+
+  template <typename... Args>
+  void emplace(Args&&... args) {
+    emplace_impl(std::forward<Args>(args)...);
+  }
+
+  bool try_pull(T& out) {
+    return consume([&](T& value) { out = std::move(value); }, 1) != 0;
+  }
+
+  /**
+   * @brief Visits up to `limit` ready elements in place.
+   *
+   * Each element is passed to `visitor` as an lvalue and destroyed right after.
+   * Drained segments are recycled on the way.
+   *
+   * @param visitor callable with `void(T&)` signature, must not throw
+   * @param limit maximum amount of elements to visit
+   * @returns number of visited elements
+   */
+  template <typename F>
+  size_t consume(F&& visitor, size_t limit = std::numeric_limits<size_t>::max()) {
+    size_t count = 0;
+    while (count < limit) {
+      if (m_tail_index == SegmentSize) {
+        segment* next = m_tail_segment->next.load(std::memory_order_acquire);
+        if (next == nullptr)
+          break;
+        recycle(std::exchange(m_tail_segment, next));
+        m_tail_index = 0;
+      }
+      slot& tail_slot = m_tail_segment->slots[m_tail_index];
+      if (!tail_slot.ready.load(std::memory_order_acquire))
+        break;
+      T* ptr = reinterpret_cast<T*>(&tail_slot.storage);
+      visitor(*ptr);
+      ptr->~T();
+      tail_slot.ready.store(false, std::memory_order_relaxed);
+      ++m_tail_index;
+      ++count;
+    }
+    return count;
+  }
+
+  /**
+   * @brief Blocks the consumer until a producer claimed a slot or `stop` is requested.
+   *
+   * Spins, yields, then parks, see @ref ngg::mpsc::parker
+   */
+  void wait_for_data(const std::stop_token& stop) {
+    const uintptr_t tail = encode(m_tail_segment, m_tail_index);
+    m_parker.wait([&] { return m_head.load(std::memory_order_seq_cst) != tail; }, stop);
+  }
+
+private:
+  struct slot {
+    alignas(T) std::byte storage[sizeof(T)];
+    std::atomic<bool> ready = false;
+  };
+
+  struct segment {
+    slot slots[SegmentSize];
+    std::atomic<segment*> next = nullptr;
+  };
+
+  // leaves room for the linking ticket and max_producers overshooting claims after it
+  static constexpr size_t segment_alignment = std::bit_ceil(
+    std::max({sizeof(segment), SegmentSize + max_producers + 1, alignof(segment)}));
+  static constexpr uintptr_t index_mask = segment_alignment - 1;
+  static constexpr size_t pool_size = 4;
+
+  static uintptr_t encode(segment* seg, size_t index) noexcept {
+    return reinterpret_cast<uintptr_t>(seg) | index;
+  }
+
+  static segment* segment_of(uintptr_t word) noexcept {
+    return reinterpret_cast<segment*>(word & ~index_mask);
+  }
+
+  static size_t index_of(uintptr_t word) noexcept {
+    return word & index_mask;
+  }
+
+  /**
+   * @brief Producer threads registered with a queue, shared with their thread_local handles
+   */
+  struct producer_count {
+    std::atomic<size_t> value = 0;
+  };
+
+  /**
+   * @brief Queues the calling thread pushed to, it leaves every one of them when it exits
+   *
+   * Keyed by a process-unique queue id rather than the address, which may be reused.
+   */
+  struct thread_registrations {
+    struct entry {
+      uint64_t queue_id;
+      std::shared_ptr<producer_count> producers;
+    };
+
+    ~thread_registrations() {
+      for (auto& e : entries)
+        e.producers->value.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    std::vector<entry> entries;
+    uint64_t last_id = 0;  // single entry cache of the hot path
+  };
+
+  static uint64_t next_id() noexcept {
+    static std::atomic<uint64_t> ids = 0;
+    return ids.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+  /**
+   * @brief Registers the calling thread as a producer once, throws past `MaxProducers`.
+   */
+  void register_producer() {
+    thread_local thread_registrations local;
+    if (local.last_id == m_id) [[likely]]
+      return;
+    const bool known = std::any_of(
+      local.entries.begin(), local.entries.end(), [&](const auto& e) { return e.queue_id == m_id; });
+    if (!known) {
+      // counts of destroyed queues are only referenced from here
+      std::erase_if(local.entries, [](const auto& e) { return e.producers.use_count() == 1; });
+      if (m_producers->value.fetch_add(1, std::memory_order_relaxed) >= MaxProducers) {
+        m_producers->value.fetch_sub(1, std::memory_order_relaxed);
+        throw std::length_error("segmented_queue: more than MaxProducers producer threads");
+      }
+      local.entries.push_back({m_id, m_producers});
+    }
+    local.last_id = m_id;
+  }
+
+  // the allocation unit, aligned so the head word can carry the claim index
+  struct alignas(segment_alignment) aligned_segment : segment {};
+
+  using segment_allocator =
+    typename std::allocator_traits<Allocator>::template rebind_alloc<aligned_segment>;
+  using segment_allocator_traits = std::allocator_traits<segment_allocator>;
+
+  segment* make_segment() {
+    aligned_segment* seg = segment_allocator_traits::allocate(m_segment_alloc, 1);
+    segment_allocator_traits::construct(m_segment_alloc, seg);
+    return seg;
+  }
+
+  void free_segment(segment* seg) noexcept {
+    auto* aligned = static_cast<aligned_segment*>(seg);
+    segment_allocator_traits::destroy(m_segment_alloc, aligned);
+    segment_allocator_traits::deallocate(m_segment_alloc, aligned, 1);
+  }
+
+  /**
+   * @brief Hands a drained segment to the pool, frees it if the pool is full.
+   *
+   * The pool is single producer (consumer thread) single consumer (whichever
+   * producer links the next segment, which is one at a time).
+   */
+  void recycle(segment* seg) noexcept {
+    seg->next.store(nullptr, std::memory_order_relaxed);
+    const size_t head = m_pool_head.load(std::memory_order_relaxed);
+    if (head - m_pool_tail.load(std::memory_order_acquire) == pool_size) {
+      free_segment(seg);
+      return;
+    }
+    m_pool[head % pool_size].store(seg, std::memory_order_relaxed);
+    m_pool_head.store(head + 1, std::memory_order_release);
+  }
+
+  segment* reuse_or_make_segment() {
+    const size_t tail = m_pool_tail.load(std::memory_order_relaxed);
+    if (tail == m_pool_head.load(std::memory_order_acquire))
+      return make_segment();
+    segment* seg = m_pool[tail % pool_size].load(std::memory_order_relaxed);
+    m_pool_tail.store(tail + 1, std::memory_order_release);
+    return seg;
+  }
+
+  /**
+   * @brief Links a fresh segment after `seg` and makes it the head.
+   *
+   * Called by the single producer that claimed index `SegmentSize` of `seg`.
+   */
+  void install_next(segment* seg) {
+    segment* next = nullptr;
+    try {
+      next = reuse_or_make_segment();
+    }
+    catch (...) {
+      // reopen the linking ticket so the next claim retries the allocation
+      m_head.store(encode(seg, SegmentSize), std::memory_order_seq_cst);
+      throw;
+    }
+    seg->next.store(next, std::memory_order_release);
+    // overwrites the claims of the overshooting producers, they retry on the new segment
+    m_head.store(encode(next, 0), std::memory_order_seq_cst);
+  }
+
+  /**
+   * @brief Waits until the head moved past an overshot `seg`, or reopened its linking ticket.
+   *
+   * Does not touch the segment itself, and yields in case the linking producer was preempted.
+   */
+  uintptr_t wait_for_next(segment* seg) noexcept {
+    backoff wait;
+    uintptr_t current = m_head.load(std::memory_order_acquire);
+    while (segment_of(current) == seg && index_of(current) > SegmentSize) {
+      wait.pause();
+      current = m_head.load(std::memory_order_acquire);
+    }
+    return current;
+  }
+
+  template <typename... Args>
+  void emplace_impl(Args&&... args) {
+    register_producer();
+    uintptr_t current = m_head.load(std::memory_order_relaxed);
+    while (true) {
+      // never increments past an overshot index, so the overshoot is bounded by the producers
+      if (index_of(current) > SegmentSize) [[unlikely]]
+        current = wait_for_next(segment_of(current));
+      // seq_cst pairs with the parked consumer, see ngg::mpsc::parker
+      const uintptr_t word = m_head.fetch_add(1, std::memory_order_seq_cst);
+      segment* seg = segment_of(word);
+      const size_t index = index_of(word);
+      if (index < SegmentSize) [[likely]] {
+        slot& head_slot = seg->slots[index];
+        new (&head_slot.storage) T(std::forward<Args>(args)...);
+        head_slot.ready.store(true, std::memory_order_release);
+        m_parker.notify();
+        return;
+      }
+      if (index == SegmentSize) {
+        install_next(seg);
+        current = m_head.load(std::memory_order_relaxed);
+        continue;
+      }
+      // registration keeps the overshooting threads below MaxProducers
+      assert(index - SegmentSize < MaxProducers);
+      current = wait_for_next(seg);
+    }
+  }
+
+  const uint64_t m_id = next_id();
+  std::shared_ptr<producer_count> m_producers = std::make_shared<producer_count>();
+  segment_allocator m_segment_alloc;  // alloc instance to support stateful allocators
+  alignas(64) std::atomic<uintptr_t> m_head;
+  alignas(64) segment* m_tail_segment;  // consumer only
+  size_t m_tail_index = 0;              // consumer only
+  std::atomic<size_t> m_pool_head = 0;  // written by the consumer
+  alignas(64) std::atomic<size_t> m_pool_tail = 0;  // written by the linking producer
+  std::atomic<segment*> m_pool[pool_size] = {};
+  parker m_parker;
+};
+
+/**
+ * @brief @ref ngg::mpsc::stable_queue with unrolled nodes of `NodeSize` elements
+ *
+ * Allocations and pointer hops drop by a factor of `NodeSize`, producers fill
+ * a node with a fetch_add instead of swapping the head per element.
+ */
+template <typename T, size_t NodeSize = 32, typename Allocator = std::allocator<T>,
+  size_t MaxProducers = 256>
+using unrolled_queue = segmented_queue<T, NodeSize, Allocator, MaxProducers>;
+
+}  // namespace ngg::mpsc
@@ -0,0 +1,243 @@
+// FROM: https://github.com/gubnik/mpsc-queue.git
+// COPYRIGHT: GNU GPL v3 or higher, Nikolay Gubankov (nikgub)
+
+#pragma once
+
+#include "spsc_ring.hpp"
+#include "types.hpp"
+#include "wait.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <stop_token>
+#include <utility>
+#include <vector>
+
+namespace ngg::mpsc {
+
+/**
+ * @brief Bounded MPSC queue made of one SPSC ring per producer thread
+ *
+ * Each producer thread gets its own @ref ngg::mpsc::spsc_queue the first time
+ * it pushes, found through a thread_local handle afterwards, so producers never
+ * write to a shared cache line. The consumer drains the rings round-robin,
+ * elements of a single producer keep their order, elements of different
+ * producers are not ordered against each other.
+ *
+ * A ring outlives its thread until the consumer drained it, and outlives the
+ * queue until its thread exits.
+ *
+ * @tparam T inner data type
+ */
+template <types::trasferable T>
+class sharded_queue {
+public:
+  /**
+   * @param shard_capacity_pow2 capacity of every producer's ring
+   * @param storage_opts storage of every producer's ring
+   */
+  explicit sharded_queue(size_t shard_capacity_pow2, const storage_options& storage_opts = {}) :
+    m_shard_capacity(shard_capacity_pow2), m_storage_opts(storage_opts) {
+    // fail here rather than in the first producer
+    if (m_shard_capacity < 2 || (m_shard_capacity & (m_shard_capacity - 1)) != 0)
+      throw std::invalid_argument("Capacity must be power of two >= 2");
+  }
+
+  sharded_queue(const sharded_queue&) = delete;
+  sharded_queue& operator=(const sharded_queue&) = delete;
+  sharded_queue(sharded_queue&&) = delete;
+  sharded_queue& operator=(sharded_queue&&) = delete;
+
+public:
+  template <backpressure Policy = backpressure::fail>
+  bool push(const T& value) {
+    return emplace_impl<Policy>(value);
+  }
+
+  template <backpressure Policy = backpressure::fail>
+  bool push(T&& value) {
+    return emplace_impl<Policy>(std::move(value));
+  }
+
+  template <backpressure Policy = backpressure::fail, typename... Args>
+  bool emplace(Args&&... args) {
+    return emplace_impl<Policy>(std::forward<Args>(args)...);
+  }
+
+  bool try_pull(T& out) {
+    return consume([&](T& value) { out = std::move(value); }, 1) != 0;
+  }
+
+  /**
+   * @brief Visits up to `limit` ready elements in place.
+   *
+   * Picks up rings of newly registered producers, then drains the rings one
+   * after another, starting one ring further on every call. Producers blocked
+   * on a full ring are woken after each ring that had elements, not once per
+   * call. Rings of exited threads are released once empty.
+   *
+   * @param visitor callable with `void(T&)` signature, must not throw
+   * @param limit maximum amount of elements to visit
+   * @returns number of visited elements
+   */
+  template <typename F>
+  size_t consume(F&& visitor, size_t limit = std::numeric_limits<size_t>::max()) {
+    if (m_has_pending.load(std::memory_order_acquire)) [[unlikely]]
+      adopt_pending();
+    const size_t shards = m_shards.size();
+    size_t count = 0;
+    for (size_t i = 0; i < shards && count < limit; ++i) {
+      const size_t visited =
+        m_shards[(m_next + i) % shards]->queue.consume(visitor, limit - count);
+      if (visited != 0)
+        m_space.notify_fenced();
+      count += visited;
+    }
+    if (shards != 0)
+      m_next = (m_next + 1) % shards;
+    if (count == 0)
+      release_retired();
+    return count;
+  }
+
+  /**
+   * @brief Blocks the consumer until a producer published or `stop` is requested.
+   *
+   * Spins, yields, then parks, see @ref ngg::mpsc::parker
+   */
+  void wait_for_data(const std::stop_token& stop) {
+    m_parker.wait(
+      [&] {
+        return m_has_pending.load(std::memory_order_seq_cst) ||
+          std::any_of(m_shards.begin(), m_shards.end(),
+            [](const auto& shard) { return !shard->queue.empty(); });
+      },
+      stop);
+  }
+
+  size_t shard_capacity() const {
+    return m_shard_capacity;
+  }
+
+  /**
+   * @brief Amount of elements rejected under @ref ngg::mpsc::backpressure::drop
+   */
+  uint64_t dropped() const {
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct shard {
+    shard(size_t capacity, const storage_options& storage_opts) : queue(capacity, storage_opts) {}
+
+    spsc_queue<T> queue;
+    std::atomic<bool> retired = false;  // set once its thread exited
+  };
+
+  /**
+   * @brief Rings of the calling thread, one per queue it pushed to
+   *
+   * Keyed by a process-unique queue id rather than the address, which may be reused.
+   */
+  struct thread_shards {
+    struct entry {
+      uint64_t queue_id;
+      std::shared_ptr<shard> ring;
+    };
+
+    ~thread_shards() {
+      for (auto& e : entries)
+        e.ring->retired.store(true, std::memory_order_release);
+    }
+
+    std::vector<entry> entries;
+    uint64_t last_id = 0;  // single entry cache of the hot path
+    shard* last = nullptr;
+  };
+
+  static uint64_t next_id() noexcept {
+    static std::atomic<uint64_t> ids = 0;
+    return ids.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+  shard& local_shard() {
+    thread_local thread_shards local;
+    if (local.last_id == m_id) [[likely]]
+      return *local.last;
+    auto it = std::find_if(local.entries.begin(), local.entries.end(),
+      [&](const auto& e) { return e.queue_id == m_id; });
+    if (it == local.entries.end()) {
+      // rings of destroyed queues are only referenced from here
+      std::erase_if(local.entries, [](const auto& e) { return e.ring.use_count() == 1; });
+      auto ring = std::make_shared<shard>(m_shard_capacity, m_storage_opts);
+      {
+        const std::lock_guard lock(m_registration);
+        m_pending.push_back(ring);
+        m_has_pending.store(true, std::memory_order_seq_cst);
+      }
+      local.entries.push_back({m_id, std::move(ring)});
+      it = std::prev(local.entries.end());
+    }
+    local.last_id = m_id;
+    local.last = it->ring.get();
+    return *local.last;
+  }
+
+  void adopt_pending() {
+    const std::lock_guard lock(m_registration);
+    for (auto& ring : m_pending)
+      m_shards.push_back(std::move(ring));
+    m_pending.clear();
+    m_has_pending.store(false, std::memory_order_relaxed);
+  }
+
+  void release_retired() {
+    // the final push of a retired ring happens before `retired` is set, so it is seen here
+    std::erase_if(m_shards, [](const auto& shard) {
+      return shard->retired.load(std::memory_order_acquire) && shard->queue.empty();
+    });
+  }
+
+  template <backpressure Policy, typename... Args>
+  bool emplace_impl(Args&&... args) {
+    shard& own = local_shard();
+    // a full ring leaves `args` untouched, so they can be forwarded again
+    const auto try_emplace = [&] { return own.queue.emplace(std::forward<Args>(args)...); };
+    bool queued = try_emplace();
+    if (!queued) [[unlikely]] {
+      if constexpr (Policy == backpressure::drop)
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+      if constexpr (Policy == backpressure::spin || Policy == backpressure::block) {
+        backoff wait;
+        while (!queued && !wait.exhausted()) {
+          wait.pause();
+          queued = try_emplace();
+        }
+      }
+      if constexpr (Policy == backpressure::block)
+        if (!queued)
+          queued = m_space.wait_until(try_emplace, {}, waiters::clock::time_point::max());
+    }
+    if (queued)
+      m_parker.notify();
+    return queued;
+  }
+
+  const uint64_t m_id = next_id();
+  size_t m_shard_capacity;
+  storage_options m_storage_opts;
+  std::vector<std::shared_ptr<shard>> m_shards;  // consumer only
+  size_t m_next = 0;                             // consumer only
+  alignas(64) std::atomic<bool> m_has_pending = false;
+  std::mutex m_registration;
+  std::vector<std::shared_ptr<shard>> m_pending;
+  alignas(64) std::atomic<uint64_t> m_dropped = 0;
+  parker m_parker;   // sleeping consumer, woken by producers
+  waiters m_space;  // sleeping producers, woken by the consumer
+};
+
+}  // namespace ngg::mpsc
@@ -0,0 +1,211 @@
+// FROM: https://github.com/gubnik/mpsc-queue.git
+// COPYRIGHT: GNU GPL v3 or higher, Nikolay Gubankov (nikgub)
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace ngg::mpsc {
+
+/**
+ * @brief Where the pages of queue storage are placed on a NUMA host
+ */
+enum class numa_policy {
+  first_touch,  // wherever the thread touching a page first runs, the OS default
+  local,        // on a single node, meant to be the one running the consumer
+  interleave,   // round-robin over every online node
+};
+
+namespace numa {
+
+namespace detail {
+
+/**
+ * @brief Calls `f(i)` for every `i` of a sysfs list such as "0-3,8,10-11".
+ */
+template <typename F>
+void for_each_in_list(const std::string& list, F&& f) {
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t end = 0;
+    const unsigned long first = std::stoul(list.substr(pos), &end);
+    pos += end;
+    unsigned long last = first;
+    if (pos < list.size() && list[pos] == '-') {
+      last = std::stoul(list.substr(pos + 1), &end);
+      pos += end + 1;
+    }
+    for (unsigned long i = first; i <= last; ++i)
+      f(static_cast<size_t>(i));
+    if (pos < list.size() && list[pos] == ',')
+      ++pos;
+    else
+      break;
+  }
+}
+
+inline std::string read_line(const std::string& path) {
+  std::ifstream file(path);
+  std::string line;
+  std::getline(file, line);
+  return line;
+}
+
+}  // namespace detail
+
+/**
+ * @brief Online NUMA nodes, `{0}` on hosts or platforms without NUMA
+ */
+inline std::vector<int> online_nodes() {
+  std::vector<int> nodes;
+#if defined(__linux__)
+  try {
+    detail::for_each_in_list(detail::read_line("/sys/devices/system/node/online"),
+      [&](size_t node) { nodes.push_back(static_cast<int>(node)); });
+  }
+  catch (...) {
+    nodes.clear();
+  }
+#endif
+  if (nodes.empty())
+    nodes.push_back(0);
+  return nodes;
+}
+
+/**
+ * @brief Node of the CPU the calling thread runs on, cheap enough to sample on a hot path
+ */
+inline int current_node() noexcept {
+#if defined(__linux__)
+  unsigned cpu = 0;
+  unsigned node = 0;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 29)
+  if (::getcpu(&cpu, &node) != 0)  // vDSO, no syscall
+    return 0;
+#else
+  if (::syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+    return 0;
+#endif
+  return static_cast<int>(node);
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @brief Applies `policy` to pages of `[data, data + size)` that were not touched yet.
+ *
+ * `data` must be page aligned. Failures are ignored, the pages then simply
+ * follow first touch.
+ *
+ * @param node target of @ref ngg::mpsc::numa_policy::local
+ */
+inline void bind_memory(void* data, size_t size, numa_policy policy, int node) noexcept {
+#if defined(__linux__)
+  if (policy == numa_policy::first_touch)
+    return;
+  constexpr size_t bits = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> mask;
+  int mode = MPOL_PREFERRED;  // falls back to other nodes instead of failing allocations
+  try {
+    const auto set = [&](size_t n) {
+      mask.resize(std::max(mask.size(), n / bits + 1));
+      mask[n / bits] |= 1ul << (n % bits);
+    };
+    if (policy == numa_policy::interleave) {
+      mode = MPOL_INTERLEAVE;
+      for (const int n : online_nodes())
+        set(static_cast<size_t>(n));
+    }
+    else
+      set(static_cast<size_t>(node));
+  }
+  catch (...) {
+    return;
+  }
+  // the kernel reads maxnode - 1 bits
+  ::syscall(SYS_mbind, data, size, mode, mask.data(), mask.size() * bits + 1, 0);
+#else
+  (void)data;
+  (void)size;
+  (void)policy;
+  (void)node;
+#endif
+}
+
+/**
+ * @brief Restricts the calling thread to the CPUs of `node`.
+ *
+ * @returns false if the affinity could not be changed
+ */
+inline bool pin_thread(int node) noexcept {
+#if defined(__linux__)
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  try {
+    detail::for_each_in_list(
+      detail::read_line("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"),
+      [&](size_t cpu) {
+        if (cpu < CPU_SETSIZE)
+          CPU_SET(cpu, &cpus);
+      });
+  }
+  catch (...) {
+    return false;
+  }
+  return CPU_COUNT(&cpus) != 0 && ::sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+#else
+  (void)node;
+  return false;
+#endif
+}
+
+/**
+ * @brief Sampled count of producers running on another node than the queue
+ *
+ * Every `sample_period`-th call per thread checks the caller's node, so the
+ * hot path pays a thread-local increment and, rarely, a vDSO call.
+ */
+class cross_node_counter {
+public:
+  static constexpr uint32_t sample_period = 64;
+
+  void sample(int home) noexcept {
+    thread_local uint32_t calls = 0;
+    if (home < 0 || ++calls % sample_period != 0) [[likely]]
+      return;
+    m_sampled.fetch_add(1, std::memory_order_relaxed);
+    if (current_node() != home)
+      m_remote.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  uint64_t sampled() const noexcept {
+    return m_sampled.load(std::memory_order_relaxed);
+  }
+
+  // Amount of samples taken on a remote node, `remote() / sampled()` is the cross-node ratio.
+  uint64_t remote() const noexcept {
+    return m_remote.load(std::memory_order_relaxed);
+  }
+
+private:
+  alignas(64) std::atomic<uint64_t> m_sampled = 0;
+  std::atomic<uint64_t> m_remote = 0;
+};
+
+}  // namespace numa
+
+}  // namespace ngg::mpsc
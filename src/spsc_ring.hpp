@@ -0,0 +1,127 @@
+// FROM: https://github.com/gubnik/mpsc-queue.git
+// COPYRIGHT: GNU GPL v3 or higher, Nikolay Gubankov (nikgub)
+
+#pragma once
+
+#include "storage.hpp"
+#include "types.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+namespace ngg::mpsc {
+
+/**
+ * @brief Wait-free SPSC queue based on a ring buffer
+ *
+ * Building block of @ref ngg::mpsc::sharded_queue. The producer owns the head,
+ * the consumer owns the tail, each keeps a cached copy of the other's index so
+ * the shared line is only read when the cached one says full or empty.
+ *
+ * @tparam T inner data type
+ */
+template <types::trasferable T>
+class spsc_queue {
+public:
+  explicit spsc_queue(size_t capacity_pow2, const storage_options& storage_opts = {}) :
+    m_capacity(checked_capacity(capacity_pow2)), m_mask(m_capacity - 1),
+    m_storage(sizeof(cell) * m_capacity, std::max(size_t{64}, alignof(cell)), storage_opts),
+    m_cells(static_cast<cell*>(m_storage.data())) {}
+
+  ~spsc_queue() {
+    consume([](T&) {});
+  }
+
+  spsc_queue(const spsc_queue&) = delete;
+  spsc_queue& operator=(const spsc_queue&) = delete;
+  spsc_queue(spsc_queue&&) = delete;
+  spsc_queue& operator=(spsc_queue&&) = delete;
+
+public:
+  bool push(const T& value) {
+    return emplace(value);
+  }
+
+  bool push(T&& value) {
+    return emplace(std::move(value));
+  }
+
+  /**
+   * @brief Constructs an element from provided args. Called by the producer only.
+   *
+   * @returns false if the queue is full, `args` are left untouched then
+   */
+  template <typename... Args>
+  bool emplace(Args&&... args) {
+    const uint64_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_cached_tail == m_capacity) {
+      m_cached_tail = m_tail.load(std::memory_order_acquire);
+      if (head - m_cached_tail == m_capacity)
+        return false;
+    }
+    new (&m_cells[head & m_mask].storage) T(std::forward<Args>(args)...);
+    // seq_cst pairs with a parked consumer, see ngg::mpsc::parker
+    m_head.store(head + 1, std::memory_order_seq_cst);
+    return true;
+  }
+
+  /**
+   * @brief Visits up to `limit` elements in place. Called by the consumer only.
+   *
+   * @param visitor callable with `void(T&)` signature, must not throw
+   * @param limit maximum amount of elements to visit
+   * @returns number of visited elements
+   */
+  template <typename F>
+  size_t consume(F&& visitor, size_t limit = std::numeric_limits<size_t>::max()) {
+    const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    if (m_cached_head == tail)
+      m_cached_head = m_head.load(std::memory_order_acquire);
+    const auto count = static_cast<size_t>(std::min<uint64_t>(m_cached_head - tail, limit));
+    for (uint64_t pos = tail; pos != tail + count; ++pos) {
+      T* ptr = reinterpret_cast<T*>(&m_cells[pos & m_mask].storage);
+      visitor(*ptr);
+      ptr->~T();
+    }
+    if (count != 0)
+      m_tail.store(tail + count, std::memory_order_release);
+    return count;
+  }
+
+  /**
+   * @brief Checks for published elements. Called by the consumer only.
+   */
+  bool empty() const {
+    return m_head.load(std::memory_order_seq_cst) == m_tail.load(std::memory_order_relaxed);
+  }
+
+  size_t capacity() const {
+    return m_capacity;
+  }
+
+private:
+  struct cell {
+    alignas(T) std::byte storage[sizeof(T)];
+  };
+
+  static size_t checked_capacity(size_t capacity) {
+    if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+      throw std::invalid_argument("Capacity must be power of two >= 2");
+    return capacity;
+  }
+
+  size_t m_capacity;
+  size_t m_mask;
+  storage m_storage;
+  cell* m_cells;
+  alignas(64) std::atomic<uint64_t> m_head = 0;  // written by the producer
+  uint64_t m_cached_tail = 0;                    // producer only
+  alignas(64) std::atomic<uint64_t> m_tail = 0;  // written by the consumer
+  uint64_t m_cached_head = 0;                    // consumer only
+};
+
+}  // namespace ngg::mpsc
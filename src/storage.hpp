@@ -0,0 +1,237 @@
+// FROM: https://github.com/gubnik/mpsc-queue.git
+// COPYRIGHT: GNU GPL v3 or higher, Nikolay Gubankov (nikgub)
+
+#pragma once
+
+#include "numa.hpp"
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <system_error>
+#include <utility>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+namespace ngg::mpsc {
+
+/**
+ * @brief How queue storage is brought up
+ */
+enum class storage_init {
+  eager,  // zero-filled and prefaulted up front, every page is touched in the constructor
+  lazy,   // zero-filled anonymous pages, each faulted in on first use
+};
+
+/**
+ * @brief Page size backing queue storage
+ */
+enum class page_size {
+  normal,            // whatever the allocator hands out
+  transparent_huge,  // 2 MiB aligned mapping advised for transparent huge pages (Linux)
+  huge,              // explicit huge pages (hugetlbfs, Windows large pages), falls back to
+                     // transparent ones when none are available
+};
+
+/**
+ * @brief Runtime options of the memory block backing a queue
+ */
+struct storage_options {
+  storage_init init = storage_init::eager;
+  page_size pages = page_size::normal;
+  // pins the block in RAM (mlock, VirtualLock), throws std::system_error if not permitted
+  bool lock = false;
+  numa_policy numa = numa_policy::first_touch;
+  // target of numa_policy::local, -1 is the node of the constructing thread
+  int numa_node = -1;
+};
+
+/**
+ * @brief Owning, zero-filled and aligned block of memory
+ *
+ * With @ref ngg::mpsc::storage_init::lazy or huge pages the block is an
+ * anonymous mapping (mmap, VirtualAlloc), which the OS hands out zero-filled
+ * without touching it, so construction is O(1) and RSS only grows with use.
+ * Platforms without anonymous mappings, and alignments above the page size,
+ * fall back to the heap.
+ *
+ * Eager storage combined with `lock` never page faults after construction.
+ * A NUMA policy other than first touch also implies a mapping, the policy is
+ * applied before any page is touched.
+ */
+class storage {
+public:
+  storage(size_t size, size_t alignment, const storage_options& options = {}) :
+    m_size(size), m_alignment(alignment) {
+    if ((options.init == storage_init::lazy || options.pages != page_size::normal ||
+          options.numa != numa_policy::first_touch) &&
+        alignment <= min_page_size)
+      m_data = map(options.pages);
+    if (m_data != nullptr) {
+      if (options.numa == numa_policy::local)
+        m_numa_node = options.numa_node >= 0 ? options.numa_node : numa::current_node();
+      numa::bind_memory(m_data, m_mapped_size, options.numa, m_numa_node);
+      if (options.init == storage_init::eager)
+        prefault();
+    }
+    else {
+      m_data = ::operator new(size, std::align_val_t{alignment});
+      std::memset(m_data, 0, size);
+    }
+    if (options.lock)
+      lock();
+  }
+
+  ~storage() {
+    release();
+  }
+
+  storage(const storage&) = delete;
+  storage& operator=(const storage&) = delete;
+  storage(storage&&) = delete;
+  storage& operator=(storage&&) = delete;
+
+  void* data() const noexcept {
+    return m_data;
+  }
+
+  size_t size() const noexcept {
+    return m_size;
+  }
+
+  /**
+   * @brief Node the block is bound to, -1 unless placed with @ref ngg::mpsc::numa_policy::local
+   */
+  int numa_node() const noexcept {
+    return m_numa_node;
+  }
+
+private:
+  static constexpr size_t min_page_size = 4'096;
+  static constexpr size_t huge_page_size = 2 * 1'024 * 1'024;
+
+  static constexpr size_t round_up(size_t value, size_t alignment) noexcept {
+    return (value + alignment - 1) / alignment * alignment;
+  }
+
+  /**
+   * @brief Maps zero-filled anonymous memory, sets `m_mapped_size` on success.
+   */
+  void* map(page_size pages) noexcept {
+#if defined(__linux__)
+    constexpr int prot = PROT_READ | PROT_WRITE;
+    constexpr int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (pages == page_size::normal) {
+      void* data = ::mmap(nullptr, m_size, prot, flags, -1, 0);
+      if (data == MAP_FAILED)
+        return nullptr;
+      m_mapped_size = m_size;
+      return data;
+    }
+    const size_t bytes = round_up(m_size, huge_page_size);
+    if (pages == page_size::huge) {
+      void* data = ::mmap(nullptr, bytes, prot, flags | MAP_HUGETLB, -1, 0);
+      if (data != MAP_FAILED) {
+        m_mapped_size = bytes;
+        return data;
+      }
+    }
+    // THP only backs 2 MiB aligned ranges, so over-map and trim both ends
+    void* raw = ::mmap(nullptr, bytes + huge_page_size, prot, flags, -1, 0);
+    if (raw == MAP_FAILED)
+      return nullptr;
+    const auto begin = reinterpret_cast<uintptr_t>(raw);
+    const uintptr_t aligned = round_up(begin, huge_page_size);
+    if (aligned != begin)
+      ::munmap(raw, aligned - begin);
+    if (aligned - begin != huge_page_size)
+      ::munmap(reinterpret_cast<void*>(aligned + bytes), huge_page_size - (aligned - begin));
+    ::madvise(reinterpret_cast<void*>(aligned), bytes, MADV_HUGEPAGE);
+    m_mapped_size = bytes;
+    return reinterpret_cast<void*>(aligned);
+#elif defined(_WIN32)
+    if (pages == page_size::huge) {
+      // large pages are committed and locked up front, requires SeLockMemoryPrivilege
+      if (const size_t large = ::GetLargePageMinimum(); large != 0) {
+        const size_t bytes = round_up(m_size, large);
+        if (void* data = ::VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+              PAGE_READWRITE)) {
+          m_mapped_size = bytes;
+          return data;
+        }
+      }
+    }
+    void* data = ::VirtualAlloc(nullptr, m_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (data != nullptr)
+      m_mapped_size = m_size;
+    return data;
+#else
+    (void)pages;
+    return nullptr;
+#endif
+  }
+
+  // the mapping is already zero-filled, a write per page only faults it in
+  void prefault() noexcept {
+    auto* bytes = static_cast<volatile std::byte*>(m_data);
+    for (size_t offset = 0; offset < m_size; offset += min_page_size)
+      bytes[offset] = std::byte{0};
+  }
+
+  void lock() {
+#if defined(__linux__)
+    if (::mlock(m_data, m_size) != 0) {
+      const int error = errno;
+      release();
+      throw std::system_error(error, std::generic_category(), "Could not lock queue storage");
+    }
+#elif defined(_WIN32)
+    if (!::VirtualLock(m_data, m_size)) {
+      const auto error = static_cast<int>(::GetLastError());
+      release();
+      throw std::system_error(error, std::system_category(), "Could not lock queue storage");
+    }
+#else
+    release();
+    throw std::system_error(std::make_error_code(std::errc::not_supported),
+      "Could not lock queue storage");
+#endif
+    m_locked = true;
+  }
+
+  void release() noexcept {
+    if (m_data == nullptr)
+      return;
+    if (m_locked) {
+#if defined(__linux__)
+      ::munlock(m_data, m_size);
+#elif defined(_WIN32)
+      ::VirtualUnlock(m_data, m_size);
+#endif
+    }
+    if (m_mapped_size != 0) {
+#if defined(__linux__)
+      ::munmap(m_data, m_mapped_size);
+#elif defined(_WIN32)
+      ::VirtualFree(m_data, 0, MEM_RELEASE);
+#endif
+    }
+    else
+      ::operator delete(m_data, std::align_val_t{m_alignment});
+    m_data = nullptr;
+  }
+
+  void* m_data = nullptr;
+  size_t m_size;
+  size_t m_alignment;
+  size_t m_mapped_size = 0;  // non-zero for anonymous mappings
+  bool m_locked = false;
+  int m_numa_node = -1;
+};
+
+}  // namespace ngg::mpsc
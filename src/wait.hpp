@@ -0,0 +1,267 @@
+// FROM: https://github.com/gubnik/mpsc-queue.git
+// COPYRIGHT: GNU GPL v3 or higher, Nikolay Gubankov (nikgub)
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stop_token>
+#include <thread>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <ctime>
+#elif defined(_WIN32) && _WIN32_WINNT >= 0x0602
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#define NGG_MPSC_WAIT_ON_ADDRESS
+#endif
+
+namespace ngg::mpsc {
+
+/**
+ * @brief What a producer does when the queue has no free slot
+ *
+ * Only `drop` counts the element in the queue's `dropped()`, the other
+ * policies leave it to the caller, who is told by the false return.
+ */
+enum class backpressure {
+  fail,   // return false right away
+  spin,   // retry with bounded backoff, return false once it is exhausted
+  block,  // retry until a slot frees up
+  drop,   // count the element as dropped and return false
+};
+
+/**
+ * @brief Hints the CPU that the caller is busy-waiting
+ */
+inline void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(_M_X64)
+  _mm_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+/**
+ * @brief Bounded exponential backoff for retry loops
+ *
+ * Spins in exponentially growing bursts of @ref ngg::mpsc::cpu_relax, then
+ * falls back to yielding the time slice.
+ */
+class backoff {
+public:
+  static constexpr uint32_t spin_limit = 6;    // up to 64 pauses per round
+  static constexpr uint32_t yield_limit = 10;  // rounds before exhausted() reports true
+
+  void pause() noexcept {
+    if (m_step <= spin_limit)
+      for (uint32_t i = 0; i < (1u << m_step); ++i)
+        cpu_relax();
+    else
+      std::this_thread::yield();
+    if (m_step <= yield_limit)
+      ++m_step;
+  }
+
+  bool exhausted() const noexcept {
+    return m_step > yield_limit;
+  }
+
+  void reset() noexcept {
+    m_step = 0;
+  }
+
+private:
+  uint32_t m_step = 0;
+};
+
+/**
+ * @brief Sleeps while `word == expected`, for at most `timeout`
+ *
+ * Thin wrapper over futex(2) and WaitOnAddress (Windows 8+), falls back to
+ * `std::atomic::wait` and sleeping elsewhere. Spurious wakeups are allowed.
+ */
+inline void futex_wait(std::atomic<uint32_t>& word, uint32_t expected,
+  std::chrono::nanoseconds timeout) noexcept {
+  if (timeout <= std::chrono::nanoseconds::zero())
+    return;
+#if defined(__linux__)
+  const auto secs = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+  timespec ts{};
+  ts.tv_sec = static_cast<time_t>(std::min<std::chrono::seconds::rep>(secs.count(), INT32_MAX));
+  ts.tv_nsec = static_cast<long>((timeout - secs).count());
+  ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, &ts,
+    nullptr, 0);
+#elif defined(NGG_MPSC_WAIT_ON_ADDRESS)
+  const auto ms = std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+  ::WaitOnAddress(&word, &expected, sizeof(expected),
+    static_cast<DWORD>(std::min<decltype(ms)>(ms, INFINITE - 1)));
+#else
+  if (timeout >= std::chrono::hours(24))
+    word.wait(expected, std::memory_order_relaxed);
+  else
+    std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(timeout, std::chrono::milliseconds(1)));
+#endif
+}
+
+/**
+ * @brief Wakes every thread sleeping in @ref ngg::mpsc::futex_wait on `word`
+ */
+inline void futex_wake_all(std::atomic<uint32_t>& word) noexcept {
+#if defined(__linux__)
+  ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr,
+    nullptr, 0);
+#elif defined(NGG_MPSC_WAIT_ON_ADDRESS)
+  ::WakeByAddressAll(&word);
+#else
+  word.notify_all();
+#endif
+}
+
+/**
+ * @brief Parking spot for a single consumer thread
+ *
+ * The consumer spins, then yields, then sleeps on a futex (`std::atomic::wait`).
+ * Producers call @ref ngg::mpsc::parker::notify after publishing, which is a
+ * single load of the sleeping flag unless the consumer is actually parked.
+ *
+ * The caller's readiness check must observe the producer's seq_cst RMW that
+ * precedes `notify()`, e.g. the head counter, so a wakeup is never lost.
+ */
+class parker {
+public:
+  static constexpr uint32_t spin_rounds = 64;
+  static constexpr uint32_t yield_rounds = 16;
+
+  /**
+   * @brief Wakes the consumer if it is parked. Called by producers.
+   */
+  void notify() noexcept {
+    if (m_sleeping.load(std::memory_order_seq_cst) != 0) [[unlikely]]
+      wake();
+  }
+
+  /**
+   * @brief Wakes the consumer unconditionally if it is parked.
+   */
+  void wake() noexcept {
+    if (m_sleeping.exchange(0, std::memory_order_seq_cst) != 0)
+      m_sleeping.notify_one();
+  }
+
+  /**
+   * @brief Blocks the consumer until `ready()` holds or `stop` is requested.
+   *
+   * @param ready predicate checked between rounds, must be cheap
+   * @param stop token that interrupts the wait
+   */
+  template <typename Ready>
+  void wait(Ready&& ready, const std::stop_token& stop) {
+    for (uint32_t i = 0; i < spin_rounds; ++i) {
+      if (ready() || stop.stop_requested())
+        return;
+      cpu_relax();
+    }
+    for (uint32_t i = 0; i < yield_rounds; ++i) {
+      if (ready() || stop.stop_requested())
+        return;
+      std::this_thread::yield();
+    }
+    const std::stop_callback on_stop(stop, [this] { wake(); });
+    m_sleeping.store(1, std::memory_order_seq_cst);
+    if (ready() || stop.stop_requested()) {
+      m_sleeping.store(0, std::memory_order_relaxed);
+      return;
+    }
+    m_sleeping.wait(1, std::memory_order_acquire);
+  }
+
+private:
+  alignas(64) std::atomic<uint32_t> m_sleeping = 0;
+};
+
+/**
+ * @brief Wait queue for producers blocked on a full queue
+ *
+ * Producers sleep on an epoch word that the consumer bumps after it freed
+ * slots. The consumer looks for sleepers once per drain pass, so producers are
+ * woken in batches, and while nobody sleeps the consumer only pays a fenced
+ * load of the waiter count.
+ *
+ * Threads that publish with a seq_cst RMW, e.g. a head CAS that waiting
+ * consumers read with a seq_cst load, use the unfenced
+ * @ref ngg::mpsc::waiters::notify instead, the pairing of
+ * @ref ngg::mpsc::parker
+ */
+class waiters {
+public:
+  using clock = std::chrono::steady_clock;
+
+  /**
+   * @brief Wakes every sleeping thread if there is any. Called after a seq_cst RMW
+   * on the state the sleepers' `ready()` reads with a seq_cst load.
+   */
+  void notify() noexcept {
+    if (m_waiting.load(std::memory_order_seq_cst) != 0) [[unlikely]]
+      wake();
+  }
+
+  /**
+   * @brief Wakes every sleeping producer if there is any. Called by the consumer
+   * after it published freed slots with plain release stores.
+   */
+  void notify_fenced() noexcept {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_waiting.load(std::memory_order_relaxed) != 0) [[unlikely]]
+      wake();
+  }
+
+  /**
+   * @brief Wakes every sleeping producer unconditionally.
+   */
+  void wake() noexcept {
+    m_epoch.fetch_add(1, std::memory_order_release);
+    futex_wake_all(m_epoch);
+  }
+
+  /**
+   * @brief Sleeps until `ready()` holds, `stop` is requested or `deadline` passes.
+   *
+   * @param ready predicate that tries to make progress, e.g. claim a slot
+   * @returns the last result of `ready()`
+   */
+  template <typename Ready>
+  bool wait_until(Ready&& ready, const std::stop_token& stop, clock::time_point deadline) {
+    const std::stop_callback on_stop(stop, [this] { wake(); });
+    // seq_cst pairs with notify(), the fence with notify_fenced()
+    m_waiting.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool result = false;
+    while (true) {
+      const uint32_t epoch = m_epoch.load(std::memory_order_acquire);
+      if ((result = ready()) || stop.stop_requested())
+        break;
+      const auto now = clock::now();
+      if (now >= deadline)
+        break;
+      futex_wait(m_epoch, epoch, deadline - now);
+    }
+    m_waiting.fetch_sub(1, std::memory_order_relaxed);
+    return result;
+  }
+
+private:
+  alignas(64) std::atomic<uint32_t> m_epoch = 0;
+  std::atomic<uint32_t> m_waiting = 0;
+};
+
+}  // namespace ngg::mpsc